@@ -0,0 +1,308 @@
+/*
+Benchmarks of the parser entry points over generated corpora.
+
+  bench_xml [--size MB] [--min-time seconds] [--filter text]
+  bench_xml --dump corpus file
+
+Every benchmark runs until min-time passes and reports time per run,
+throughput over the whole corpus and heap allocations per tree node
+(counted by replacing the global operator new).
+*/
+#include <tp_tree_xml.hpp>
+#include <tp_xml_parallel.hpp>
+
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <random>
+
+namespace {
+std::atomic<std::size_t> allocations(0);
+}
+
+// the replacements are not inlined, so the compiler never pairs an inlined
+// malloc with a free from another replacement (-Wmismatched-new-delete)
+[[gnu::noinline]] void *operator new(std::size_t n) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(n ? n : 1))
+    return p;
+  throw std::bad_alloc();
+}
+[[gnu::noinline]] void *operator new(std::size_t n, std::align_val_t a) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  const std::size_t align = static_cast<std::size_t>(a);
+  if (void *p = std::aligned_alloc(align, (n + align - 1) / align * align))
+    return p;
+  throw std::bad_alloc();
+}
+void *operator new[](std::size_t n) { return operator new(n); }
+void *operator new[](std::size_t n, std::align_val_t a) {
+  return operator new(n, a);
+}
+[[gnu::noinline]] void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { operator delete(p); }
+void operator delete(void *p, std::align_val_t) noexcept { operator delete(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept {
+  operator delete(p);
+}
+void operator delete[](void *p) noexcept { operator delete(p); }
+void operator delete[](void *p, std::size_t) noexcept { operator delete(p); }
+void operator delete[](void *p, std::align_val_t) noexcept {
+  operator delete(p);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept {
+  operator delete(p);
+}
+
+namespace corpus {
+
+using generator_t = std::string (*)(std::size_t);
+
+/**
+ * chains of nested elements, 500 levels each
+ */
+std::string deep(std::size_t size) {
+  std::string s = "<root>";
+  for (int chain = 0; s.size() < size; chain++) {
+    for (int d = 0; d < 500; d++)
+      s += "<n d=\"" + std::to_string(d) + "\">";
+    s += "leaf";
+    for (int d = 0; d < 500; d++)
+      s += "</n>";
+  }
+  return s + "</root>";
+}
+
+/**
+ * one parent with many small children
+ */
+std::string wide(std::size_t size) {
+  std::string s = "<list>\n";
+  for (int i = 0; s.size() < size; i++)
+    s += "  <item id=\"" + std::to_string(i) + "\">value " + std::to_string(i) +
+         "</item>\n";
+  return s + "</list>\n";
+}
+
+/**
+ * tags with twenty attributes, inkscape style
+ */
+std::string attributes(std::size_t size) {
+  std::mt19937 rng(1);
+  std::string s = "<svg>\n";
+  while (s.size() < size) {
+    s += "<rect";
+    for (int a = 0; a < 20; a++)
+      s += " inkscape:attr" + std::to_string(a) + "=\"" +
+           std::to_string(rng() % 100000) + "\"";
+    s += " style=\"fill:#ff0000;stroke:none;stroke-width:0.26\"/>\n";
+  }
+  return s + "</svg>\n";
+}
+
+/**
+ * text and values full of named and numeric entities
+ */
+std::string entities(std::size_t size) {
+  std::string s = "<doc>\n";
+  while (s.size() < size)
+    s += "<p title=\"a &amp; b &lt; c\">x &lt; y &amp;&amp; y &gt; z "
+         "&quot;quoted&quot; &#x263A; &#169; &nbsp;&apos;</p>\n";
+  return s + "</doc>\n";
+}
+
+/**
+ * few paths with very long d attributes
+ */
+std::string svg_paths(std::size_t size) {
+  std::mt19937 rng(2);
+  std::string s = "<?xml version=\"1.0\"?>\n<svg "
+                  "xmlns=\"http://www.w3.org/2000/svg\">\n";
+  while (s.size() < size) {
+    s += "<path d=\"M 0,0";
+    for (int i = 0; i < 20000; i++)
+      s += " L " + std::to_string(rng() % 1000) + "." +
+           std::to_string(rng() % 100) + "," + std::to_string(rng() % 1000);
+    s += " Z\" style=\"fill:none;stroke:#000000\"/>\n";
+  }
+  return s + "</svg>\n";
+}
+
+const std::vector<std::pair<std::string, generator_t>> all = {
+    {"deep", deep},
+    {"wide", wide},
+    {"attributes", attributes},
+    {"entities", entities},
+    {"svg_paths", svg_paths}};
+
+} // namespace corpus
+
+struct result_t {
+  double seconds_per_run;
+  double allocations_per_run;
+};
+
+/**
+ * runs f until min_time passes (at least twice, the first run warms up)
+ */
+template <class F> result_t measure(F f, double min_time) {
+  using clock = std::chrono::steady_clock;
+  f();
+  std::size_t runs = 0;
+  const std::size_t allocations_before = allocations.load();
+  const auto start = clock::now();
+  double elapsed = 0;
+  do {
+    f();
+    runs++;
+    elapsed = std::chrono::duration<double>(clock::now() - start).count();
+  } while (elapsed < min_time);
+  return {elapsed / runs,
+          double(allocations.load() - allocations_before) / runs};
+}
+
+/**
+ * keeps the optimizer from dropping the measured work
+ */
+template <class T> void do_not_optimize(const T &v) {
+  asm volatile("" : : "r"(&v) : "memory");
+}
+
+int main(int argc, char **argv) {
+  using namespace tp::xml;
+  using namespace tp;
+  std::size_t size = 8;
+  double min_time = 0.5;
+  std::string filter;
+  std::string dump_corpus, dump_file;
+  auto usage = [&](const std::string &message) {
+    if (message.size())
+      std::cerr << message << std::endl;
+    std::cerr << "usage: " << argv[0]
+              << " [--size MB] [--min-time seconds] [--filter text]\n"
+              << "       " << argv[0] << " --dump corpus file" << std::endl;
+    return 1;
+  };
+  // the whole argument must be the number
+  auto parse = [](std::string_view s, auto &v) {
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+    return (ec == std::errc()) && (end == s.data() + s.size());
+  };
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "--size") && (i + 1 < argc)) {
+      if (!parse(argv[++i], size) || (size == 0) || (size > (1 << 20)))
+        return usage("--size must be a number of megabytes, 1 or more");
+    } else if ((arg == "--min-time") && (i + 1 < argc)) {
+      if (!parse(argv[++i], min_time) || !std::isfinite(min_time) ||
+          (min_time < 0))
+        return usage("--min-time must be a number of seconds, 0 or more");
+    } else if ((arg == "--filter") && (i + 1 < argc)) {
+      filter = argv[++i];
+    } else if ((arg == "--dump") && (i + 2 < argc)) {
+      dump_corpus = argv[++i];
+      dump_file = argv[++i];
+    } else {
+      const bool known = (arg == "--size") || (arg == "--min-time") ||
+                         (arg == "--filter") || (arg == "--dump");
+      return usage((known ? "missing value for " : "unknown argument ") + arg);
+    }
+  }
+  if (dump_corpus.size()) {
+    for (auto &[name, generate] : corpus::all)
+      if (name == dump_corpus) {
+        std::ofstream(dump_file) << generate(size << 20);
+        return 0;
+      }
+    std::cerr << "unknown corpus " << dump_corpus << std::endl;
+    return 1;
+  }
+
+  std::printf("%-44s %12s %10s %12s\n", "Benchmark", "Time", "MB/s",
+              "allocs/node");
+  std::printf("%s\n", std::string(81, '-').c_str());
+  for (auto &[corpus_name, generate] : corpus::all) {
+    const std::string text = generate(size << 20);
+    // fragments and text runs for the per-fragment functions
+    std::vector<std::string_view> fragments;
+    std::vector<std::string> texts;
+    std::size_t text_bytes = 0;
+    helpers::tokenize_xml(text, [&](std::string_view s) {
+      fragments.push_back(s);
+      if (s.front() != '<') {
+        texts.emplace_back(s);
+        text_bytes += s.size();
+      }
+    });
+    std::size_t nodes = 0;
+    auto tree = text_to_xml(text);
+    walk_tree(tree, [&](const element_t &, int) { nodes++; });
+
+    // bytes is the part of the corpus f goes through
+    auto report = [&](const std::string &name, auto f,
+                      std::size_t bytes = 0) {
+      const std::string full = name + "/" + corpus_name;
+      if (full.find(filter) == std::string::npos)
+        return;
+      result_t r = measure(f, min_time);
+      std::printf("%-44s %9.3f ms %10.1f %12.2f\n", full.c_str(),
+                  r.seconds_per_run * 1000,
+                  (bytes ? bytes : text.size()) / 1048576.0 / r.seconds_per_run,
+                  r.allocations_per_run / nodes);
+      std::fflush(stdout);
+    };
+
+    report("simple_parse_xml", [&]() {
+      std::size_t n = 0;
+      helpers::simple_parse_xml(text, [&](std::string s) { n += s.size(); });
+      do_not_optimize(n);
+    });
+    report("string_to_tree", [&]() {
+      auto tree = helpers::string_to_tree(text);
+      do_not_optimize(tree);
+    });
+    report("str_to_element", [&]() {
+      for (auto s : fragments) {
+        auto e = helpers::str_to_element(s);
+        do_not_optimize(e);
+      }
+    });
+    report("entities_convert", [&]() {
+      for (auto &s : texts) {
+        auto e = helpers::entities_convert(s);
+        do_not_optimize(e);
+      }
+    }, text_bytes);
+    report("text_to_xml", [&]() {
+      auto tree = text_to_xml(text);
+      do_not_optimize(tree);
+    });
+    report("text_to_xml_with_entities", [&]() {
+      auto tree = text_to_xml_with_entities(text);
+      do_not_optimize(tree);
+    });
+    report("text_to_xml_with_entities<flat>", [&]() {
+      auto doc = text_to_xml_with_entities<flat_document_t>(text);
+      do_not_optimize(doc);
+    });
+    report("text_to_xml_with_entities<lazy>", [&]() {
+      auto tree = text_to_xml_with_entities<tree_elem_t<lazy_element_t>>(text);
+      do_not_optimize(tree);
+    });
+    report("pmr::document_t", [&]() {
+      pmr::document_t doc(text);
+      do_not_optimize(doc);
+    });
+    for (unsigned threads : {1u, 2u, 4u, 8u, 16u})
+      report("text_to_xml_parallel<" + std::to_string(threads) + ">", [&]() {
+        auto tree = text_to_xml_parallel(text, true, threads);
+        do_not_optimize(tree);
+      });
+  }
+  return 0;
+}
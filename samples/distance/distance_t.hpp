@@ -203,7 +203,7 @@ inline std::ostream& operator<<(std::ostream& os, generic_position_t<T,N> const&
 
 //double calculate_linear_coefficient_from_limits(const std::vector<double>& limits_for_axes, const generic_position_t& norm_vect)
 //std::vector<double>
-auto calculate_linear_coefficient_from_limits = [](const auto& limits_for_axes, const auto& norm_vect) -> double
+inline auto calculate_linear_coefficient_from_limits = [](const auto& limits_for_axes, const auto& norm_vect) -> double
 {
     double average_max_accel = 0;
     double average_max_accel_sum = 0;
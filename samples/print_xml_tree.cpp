@@ -1,18 +1,47 @@
+#include <tp_mapped_file.hpp>
 #include <tp_tree_xml.hpp>
+#include <tp_xml_parallel.hpp>
+#include <tp_xml_query.hpp>
+#include <tp_xml_incremental.hpp>
+#include <tp_xml_sax.hpp>
+#include <tp_xml_snapshot.hpp>
+#include <tp_xml_writer.hpp>
+
+#include <filesystem>
 #include <fstream>
+#include <memory>
+#include <random>
+#include <sstream>
+
+/**
+ * the tree written back as xml, to compare trees
+ */
+std::string serialized(const tp::tree_elem_t<tp::xml::element_t> &tree) {
+  std::ostringstream s;
+  {
+    tp::output_sink_t out(s);
+    tp::xml::write_xml(out, tree);
+  }
+  return s.str();
+}
 
 int main(int argc, char **argv) {
   using namespace tp::xml;
   using namespace tp;
-  std::string xml_text =
+  std::string_view xml_text =
       "<x id=\"ja'nek\" class=\"w\\\"ar>\"> <!DOCTYPE> "
       "sadf>sad </x>oraz<p>element "
       "p</p> no <bla/>i <h>do <p>non br&lt;ea&gt;kable space "
       "example:&nbsp;was here</p> oraz <x>dsfs</x></h>";
+  std::unique_ptr<mapped_file_t> input;
   if (argc > 1) {
-    std::ifstream t(argv[1]);
-    xml_text = std::string((std::istreambuf_iterator<char>(t)),
-                           std::istreambuf_iterator<char>());
+    try {
+      input = std::make_unique<mapped_file_t>(argv[1]);
+    } catch (const std::system_error &e) {
+      std::cerr << argv[0] << ": " << e.what() << std::endl;
+      return 1;
+    }
+    xml_text = input->view();
   }
   std::cout << xml_text << std::endl;
   std::cout << "-------------- A ----------" << std::endl;
@@ -21,6 +50,217 @@ int main(int argc, char **argv) {
   print_tree(text_to_xml(xml_text));
   std::cout << "-------------- C ----------" << std::endl;
   print_tree(text_to_xml_with_entities(xml_text));
+  std::cout << "-------------- D ----------" << std::endl;
+  print_tree(text_to_xml_with_entities<flat_document_t>(xml_text));
+  std::cout << "-------------- E ----------" << std::endl;
+  print_tree(text_to_xml_with_entities<tree_elem_t<lazy_element_t>>(xml_text));
+  std::cout << "-------------- F ----------" << std::endl;
+  {
+    output_sink_t out(std::cout);
+    write_xml(out, text_to_xml_with_entities(xml_text), WRITE_PRETTY);
+  }
+  std::cout << "-------------- G ----------" << std::endl;
+  print_tree(snapshot_t::from_bytes(
+      snapshot_bytes(text_to_xml_with_entities<flat_document_t>(xml_text))));
+  {
+    // load_or_parse keeps <source>.tpxs; a rewritten snapshot is a new file
+    const std::string source = (std::filesystem::temp_directory_path() /
+                                ("print_xml_tree_" +
+                                 std::to_string(::getpid()) + ".xml"))
+                                   .string();
+    const std::string cache = source + ".tpxs";
+    auto inode = [&]() {
+      struct stat st;
+      return (::stat(cache.c_str(), &st) == 0) ? st.st_ino : 0;
+    };
+    std::ofstream(source) << xml_text;
+    std::cout << "load_or_parse, no snapshot: "
+              << load_or_parse(source).size() << " nodes" << std::endl;
+    const auto written = inode();
+    std::cout << "load_or_parse, fresh snapshot: "
+              << load_or_parse(source).size() << " nodes, "
+              << ((inode() == written) ? "from the snapshot" : "parsed again")
+              << std::endl;
+    std::ofstream(source, std::ios::app) << "<more/>";
+    std::cout << "load_or_parse, stale snapshot: "
+              << load_or_parse(source).size() << " nodes, "
+              << ((inode() == written) ? "from the snapshot" : "parsed again")
+              << std::endl;
+    std::filesystem::remove(source);
+    std::filesystem::remove(cache);
+  }
+  std::cout << "-------------- H ----------" << std::endl;
+  {
+    pmr::document_t document(xml_text);
+    print_tree(document.tree());
+  }
+  std::cout << "-------------- I ----------" << std::endl;
+  {
+    const auto tree = text_to_xml(xml_text);
+    walk_tree_io(
+        tree,
+        [](const element_t &e, int d) {
+          if (std::holds_alternative<tag_t>(e) &&
+              !std::get<tag_t>(e).is_markup())
+            std::cout << std::string(d * 2, ' ') << std::get<tag_t>(e).tag
+                      << std::endl;
+        },
+        [](const element_t &, int) {});
+  }
+  std::cout << "-------------- J ----------" << std::endl;
+  {
+    const std::string_view svg =
+        "<svg><g id=\"a\"><path id=\"p1\" d=\"M 0 0\"/><path id=\"p2\"/>"
+        "<path id=\"p3\" d=\"L 1 1\"/></g><g id=\"b\"><path id=\"p4\" "
+        "d=\"Z\"/></g></svg>";
+    tag_index_t index;
+    const auto tree = text_to_xml_indexed(svg, index);
+    const auto &layer_b = *std::next(tree.children.front().children.begin());
+    auto ids = [](const std::vector<const tree_elem_t<element_t> *> &nodes) {
+      std::string ret;
+      for (auto n : nodes)
+        ret += " " + std::get<tag_t>(n->value).attr.at(name_t("id"));
+      return ret;
+    };
+    for (auto expression : {"//path", "//path[@d]", "//g[@id='a']/path[2]",
+                            "/svg/*[2]/path", "//g/*[1]"}) {
+      const query_t q(expression);
+      std::cout << expression << ":" << ids(q.select(tree))
+                << " | indexed:" << ids(q.select(tree, &index))
+                << " | in g#b:" << ids(q.select(layer_b, &index)) << std::endl;
+    }
+    std::cout << "//path/@d:";
+    for (auto d : query_t("//path/@d").values(tree, &index))
+      std::cout << " \"" << d << "\"";
+    std::cout << std::endl;
+  }
+  std::cout << "-------------- K ----------" << std::endl;
+  {
+    // big enough to be split into chunks, with '<' inside comments and
+    // attribute values near the split points
+    std::string big;
+    while (big.size() < (1 << 20))
+      big.append(xml_text).append("<!-- a <b> c -->");
+    const std::string expected = serialized(text_to_xml_with_entities(big));
+    for (unsigned threads : {1u, 2u, 4u, 8u, 16u})
+      std::cout << "text_to_xml_parallel, " << threads << " threads: "
+                << ((serialized(text_to_xml_parallel(big, true, threads)) ==
+                     expected)
+                        ? "same as text_to_xml"
+                        : "DIFFERENT")
+                << std::endl;
+  }
+  std::cout << "-------------- L ----------" << std::endl;
+  {
+    // events as lines, text pieces of one run joined
+    auto events = [&](std::size_t chunk_size) {
+      std::istringstream in{std::string(xml_text)};
+      std::vector<std::string> lines;
+      bool in_text = false;
+      parse_events(
+          in,
+          [&](const event_t &e) {
+            if ((e.type == TEXT) && in_text) {
+              lines.back().append(e.text);
+              return;
+            }
+            in_text = (e.type == TEXT);
+            switch (e.type) {
+            case START_ELEMENT:
+              lines.push_back("start " + std::string(e.name));
+              for (auto &a : e.attrs)
+                lines.back() += " " + std::string(a.name) + "=" +
+                                std::string(a.value);
+              break;
+            case END_ELEMENT:
+              lines.push_back("end " + std::string(e.name));
+              break;
+            case TEXT:
+              lines.push_back("text " + std::string(e.text));
+              break;
+            case MARKUP:
+              lines.push_back("markup " + std::string(e.name));
+              break;
+            }
+          },
+          chunk_size);
+      return lines;
+    };
+    const auto expected = events(64 * 1024);
+    for (auto &line : expected)
+      std::cout << line << std::endl;
+    for (std::size_t chunk_size : {1, 2, 5, 16})
+      std::cout << "chunk size " << chunk_size << ": "
+                << ((events(chunk_size) == expected) ? "same events"
+                                                     : "DIFFERENT")
+                << std::endl;
+  }
+  std::cout << "-------------- M ----------" << std::endl;
+  {
+    std::string text(xml_text);
+    incremental_tree_t incremental(text);
+    std::size_t accepted = 0;
+    // replaces [begin, begin + length) and checks the tree against a full
+    // parse; a broken text must be refused by both
+    auto edit = [&](std::size_t begin, std::size_t length,
+                    const std::string &replacement) {
+      std::string edited = text;
+      edited.replace(begin, length, replacement);
+      std::string expected;
+      try {
+        expected = serialized(text_to_xml_with_entities(edited));
+      } catch (const parse_error &) {
+        try {
+          incremental.update(edited, begin, length, replacement.size());
+        } catch (const parse_error &) {
+          return serialized(incremental.tree()) ==
+                 serialized(text_to_xml_with_entities(text));
+        }
+        return false;
+      }
+      incremental.update(edited, begin, length, replacement.size());
+      text = edited;
+      accepted++;
+      return serialized(incremental.tree()) == expected;
+    };
+    const std::vector<std::string> pieces = {
+        "", "x", " ", "<b>", "</b>", "<b/>", "<i>t</i>", "&amp;", "&lt",
+        "=\"v\"", " a=\"1\"", "\"", "<!-- c -->", "<!DOCTYPE>", "<", ">"};
+    std::mt19937 rng(5);
+    std::size_t same = 0, edits = 1000;
+    for (std::size_t i = 0; i < edits; i++) {
+      const std::size_t begin = rng() % (text.size() + 1);
+      const std::size_t length = std::min<std::size_t>(
+          (rng() % 3 == 0) ? rng() % 8 : 0, text.size() - begin);
+      if (edit(begin, length, pieces[rng() % pieces.size()]))
+        same++;
+    }
+    std::cout << same << " of " << edits
+              << " edits gave the same tree as text_to_xml (" << accepted
+              << " edits kept the text well formed)" << std::endl;
+  }
+  std::cout << "-------------- N ----------" << std::endl;
+  {
+    const name_t p("p");
+    auto tree = text_to_xml_with_entities(xml_text);
+    walk_tags(tree, p, [](const tag_t &t, int d) {
+      std::cout << "tree: " << t.tag << " at depth " << d << std::endl;
+    });
+    auto lazy =
+        text_to_xml_with_entities<tree_elem_t<lazy_element_t>>(xml_text);
+    walk_tags(lazy, p, [](const lazy_tag_t &t, int d) {
+      std::cout << "lazy: " << t.tag << " at depth " << d << std::endl;
+    });
+    auto flat = text_to_xml_with_entities<flat_document_t>(xml_text);
+    walk_tags(flat, p, [](const flat_element_t &e, int d) {
+      std::cout << "flat: " << e.tag() << " at depth " << d << std::endl;
+    });
+    const auto snapshot = snapshot_t::from_bytes(snapshot_bytes(flat));
+    walk_tags(snapshot, p, [](const snapshot_element_t &e, int d) {
+      std::cout << "snapshot: " << e.tag() << " at depth " << d << std::endl;
+      return WALK_STOP; // only the first one
+    });
+  }
 
   return -0;
 }
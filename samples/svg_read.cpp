@@ -1,85 +1,287 @@
 #include <distance_t.hpp>
+#include <tp_mapped_file.hpp>
+#include <tp_output_sink.hpp>
 #include <tp_tree_xml.hpp>
 
-#include <fstream>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using point_2d_t = raspigcd::generic_position_t<double, 2>;
 enum step_type_e { GOTO,
     PLOT,
     MARK };
-using plot_step_callback_t = std::function<void(step_type_e, point_2d_t)>;
 
 
 
-auto parse_path_to_cmnds = [](auto pth) {
-    std::vector<std::pair<char, std::list<std::string>>> cmnds;
-    std::vector<std::pair<char, std::vector<double>>> cmnds_ret;
+/**
+ * commands of one svg path. Numbers of all commands are in one buffer,
+ * command i takes args[commands[i].offset ... + commands[i].count).
+ * Reused from path to path, so after the first few paths nothing is
+ * allocated.
+ */
+struct path_data_t {
+    struct command_t {
+        char c;
+        std::uint32_t offset;
+        std::uint32_t count;
+    };
+    std::vector<command_t> commands;
+    std::vector<double> args;
 
-    for (auto c : pth) {
-        if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')) ||
-            (cmnds.size() == 0)) {
-            if (cmnds.size() > 0) {
-                if ((cmnds.back().second.size() > 0) &&
-                    (cmnds.back().second.back().size() == 0))
-                    cmnds.back().second.pop_back();
-            }
-            cmnds.push_back({c, {""}});
+    void clear()
+    {
+        commands.clear();
+        args.clear();
+    }
+    const double* arguments(const command_t& cmd) const
+    {
+        return args.data() + cmd.offset;
+    }
+};
+
+inline bool is_path_separator(char c)
+{
+    return (c == ' ') || (c == ',') || (c == '\t') || (c == '\n') ||
+           (c == '\r') || (c == '\f');
+}
+
+inline bool is_path_command(char c)
+{
+    switch (c | 0x20) { // lower case
+    case 'm':
+    case 'z':
+    case 'l':
+    case 'h':
+    case 'v':
+    case 'c':
+    case 's':
+    case 'q':
+    case 't':
+    case 'a':
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * reads the number at p with std::from_chars and moves p past it. The plus
+ * sign, which from_chars does not take, is skipped. from_chars also takes
+ * "inf", "nan" and "infinity", which are not svg numbers, so the digits
+ * must start right after the sign and the value must be finite.
+ */
+inline bool read_number(const char*& p, const char* e, double& v)
+{
+    const char* start = ((p < e) && (*p == '+')) ? p + 1 : p;
+    const char* digits = ((start < e) && (*start == '-')) ? start + 1 : start;
+    if ((digits == e) ||
+        !(((*digits >= '0') && (*digits <= '9')) || (*digits == '.')))
+        return false;
+    auto [end, ec] = std::from_chars(start, e, v);
+    if ((ec != std::errc()) || !std::isfinite(v))
+        return false;
+    p = end;
+    return true;
+}
+
+/**
+ * @brief reads the d attribute of path into out (cleared first)
+ *
+ * numbers are read with std::from_chars, so they do not depend on the
+ * locale and keep double precision. Compact forms like "1.5.5" (two
+ * numbers), "1e-3" and arc flags without separators ("a1 1 0 011 2 2")
+ * are understood. Like svg renderers, it stops at the first error and
+ * keeps what was read before; returns false then.
+ */
+inline bool parse_path_data(std::string_view d, path_data_t& out)
+{
+    out.clear();
+    const char* p = d.data();
+    const char* const e = p + d.size();
+    while (p < e) {
+        const char c = *p;
+        if (is_path_separator(c)) {
+            p++;
+        } else if (is_path_command(c)) {
+            out.commands.push_back({c, std::uint32_t(out.args.size()), 0});
+            p++;
         } else {
-            if (((c >= '0') && (c <= '9')) || (c == '.') ||
-                ((c == '-') && (cmnds.back().second.back().size() == 0))) {
-                if (cmnds.size() == 0)
-                    throw std::invalid_argument(
-                        "first you must specify command in svg path!!");
-                if (cmnds.back().second.size() == 0)
-                    throw std::invalid_argument(
-                        "first you must specify command in svg path!!");
-                cmnds.back().second.back().push_back(c);
-            } else {
-                if (cmnds.back().second.back().size() > 0)
-                    cmnds.back().second.push_back((c == '-') ? "-" : "");
+            if (out.commands.empty())
+                return false; // numbers before the first command
+            auto& cmd = out.commands.back();
+            const std::uint32_t arc_argument = cmd.count % 7;
+            double v;
+            if (((cmd.c == 'a') || (cmd.c == 'A')) &&
+                ((arc_argument == 3) || (arc_argument == 4))) {
+                if ((c != '0') && (c != '1'))
+                    return false;
+                v = c - '0'; // large-arc and sweep flags are one digit
+                p++;
+            } else if (!read_number(p, e, v)) {
+                return false;
             }
+            out.args.push_back(v);
+            cmd.count++;
         }
     }
-    if (cmnds.size() > 0) {
-        if ((cmnds.back().second.size() > 0) &&
-            (cmnds.back().second.back().size() == 0))
-            cmnds.back().second.pop_back();
-    }
-    for (auto& [k, v] : cmnds) {
-        std::vector<double> v2;
-        std::transform(v.begin(), v.end(), std::back_inserter(v2),
-            [](auto e) -> double {
-                if (e.size() == 0)
-                    return 0.0;
-                return std::stof(e);
-            });
-        cmnds_ret.push_back({k, v2});
-    }
-    return cmnds_ret;
-};
+    return true;
+}
 
-auto path_noop = [](auto p, auto on_plot_step) { return p; };
+auto path_noop = [](auto p, auto&) { return p; };
 
-auto path_move_to = [](auto t, auto current_point, point_2d_t new_point, auto on_plot_step) {
+auto path_move_to = [](auto t, auto, point_2d_t new_point, auto& on_plot_step) {
     on_plot_step(t, new_point);
     return new_point;
 };
 
-auto path_bezier_cubic = [](auto movetype, auto current_point, std::vector<double> args, auto on_plot_step, double dt) {
-    std::vector<point_2d_t> pts = {current_point,
+/**
+ * @brief number of chords that keep a Bézier curve within tolerance
+ *
+ * Wang's formula: n = sqrt(d (d - 1) / 8 * L / tolerance), where d is the
+ * degree and L the largest length of the second differences
+ * P[i] - 2 P[i+1] + P[i+2] of the control points. Straight curves get one
+ * chord, big or sharp ones as many as they need.
+ */
+inline int bezier_segments(const point_2d_t* p, int degree, double tolerance)
+{
+    double l = 0.0;
+    for (int i = 0; i + 2 <= degree; i++) {
+        const double dx = p[i][0] - 2 * p[i + 1][0] + p[i + 2][0];
+        const double dy = p[i][1] - 2 * p[i + 1][1] + p[i + 2][1];
+        l = std::max(l, std::sqrt(dx * dx + dy * dy));
+    }
+    const double n =
+        std::ceil(std::sqrt(degree * (degree - 1) / 8.0 * l / tolerance));
+    return int(std::clamp(n, 1.0, 65536.0));
+}
+
+/**
+ * args are the two control points and the end point. The curve is cut into
+ * bezier_segments chords.
+ */
+auto path_bezier_cubic = [](auto movetype, auto current_point, const double* args, auto& on_plot_step, double tolerance) {
+    const point_2d_t p[4] = {current_point,
         {args[0], args[1]},
         {args[2], args[3]},
         {args[4], args[5]}};
+    const int n = bezier_segments(p, 3, tolerance);
+    for (int i = 1; i < n; i++) {
+        const double t = double(i) / n;
+        const double s = 1.0 - t;
+        const double b0 = s * s * s, b1 = 3 * s * s * t, b2 = 3 * s * t * t,
+                     b3 = t * t * t;
+        on_plot_step(movetype,
+            point_2d_t{b0 * p[0][0] + b1 * p[1][0] + b2 * p[2][0] + b3 * p[3][0],
+                b0 * p[0][1] + b1 * p[1][1] + b2 * p[2][1] + b3 * p[3][1]});
+    }
+    on_plot_step(movetype, p[3]);
+    return p[3];
+};
+
+/**
+ * args are the control point and the end point, like in path_bezier_cubic
+ */
+auto path_bezier_quadratic = [](auto movetype, auto current_point, const double* args, auto& on_plot_step, double tolerance) {
+    const point_2d_t p[3] = {current_point,
+        {args[0], args[1]},
+        {args[2], args[3]}};
+    const int n = bezier_segments(p, 2, tolerance);
+    for (int i = 1; i < n; i++) {
+        const double t = double(i) / n;
+        const double s = 1.0 - t;
+        const double b0 = s * s, b1 = 2 * s * t, b2 = t * t;
+        on_plot_step(movetype,
+            point_2d_t{b0 * p[0][0] + b1 * p[1][0] + b2 * p[2][0],
+                b0 * p[0][1] + b1 * p[1][1] + b2 * p[2][1]});
+    }
+    on_plot_step(movetype, p[2]);
+    return p[2];
+};
+
+/**
+ * @brief elliptical arc, args like in the A command: rx ry x-axis-rotation
+ * large-arc-flag sweep-flag x y
+ *
+ * converted to the center form as in the SVG implementation notes (F.6.5,
+ * with radii scaled up when they are too small, F.6.6). The angle step
+ * keeps chords within tolerance of the larger radius.
+ */
+auto path_arc = [](auto movetype, auto current_point, const double* args, auto& on_plot_step, double tolerance) {
+    const point_2d_t end = {args[5], args[6]};
+    double rx = std::abs(args[0]);
+    double ry = std::abs(args[1]);
+    if (current_point == end)
+        return end;
+    if ((rx == 0.0) || (ry == 0.0)) {
+        on_plot_step(movetype, end);
+        return end;
+    }
+    const double phi = args[2] * M_PI / 180.0;
+    const double cos_phi = std::cos(phi), sin_phi = std::sin(phi);
+    const double hx = (current_point[0] - end[0]) / 2;
+    const double hy = (current_point[1] - end[1]) / 2;
+    const double x1 = cos_phi * hx + sin_phi * hy;
+    const double y1 = -sin_phi * hx + cos_phi * hy;
+    const double lambda = (x1 * x1) / (rx * rx) + (y1 * y1) / (ry * ry);
+    if (lambda > 1.0) {
+        rx *= std::sqrt(lambda);
+        ry *= std::sqrt(lambda);
+    }
+    const double rx2 = rx * rx, ry2 = ry * ry;
+    const double num = rx2 * ry2 - rx2 * y1 * y1 - ry2 * x1 * x1;
+    const double den = rx2 * y1 * y1 + ry2 * x1 * x1;
+    double k = std::sqrt(std::max(0.0, num / den));
+    if ((args[3] != 0.0) == (args[4] != 0.0))
+        k = -k;
+    const double cx1 = k * rx * y1 / ry;
+    const double cy1 = -k * ry * x1 / rx;
+    const double cx = cos_phi * cx1 - sin_phi * cy1 +
+                      (current_point[0] + end[0]) / 2;
+    const double cy = sin_phi * cx1 + cos_phi * cy1 +
+                      (current_point[1] + end[1]) / 2;
+    const double theta = std::atan2((y1 - cy1) / ry, (x1 - cx1) / rx);
+    double delta =
+        std::atan2((-y1 - cy1) / ry, (-x1 - cx1) / rx) - theta;
+    if ((args[4] == 0.0) && (delta > 0))
+        delta -= 2 * M_PI;
+    else if ((args[4] != 0.0) && (delta < 0))
+        delta += 2 * M_PI;
 
-    for (double t = dt; t <= 1.0; t += dt) {
-        current_point = raspigcd::bezier(pts, t);
-        on_plot_step(movetype, current_point);
+    const double r = std::max(rx, ry);
+    const double step =
+        (tolerance < r) ? 2 * std::acos(1.0 - tolerance / r) : M_PI / 2;
+    const int n = int(std::clamp(std::ceil(std::abs(delta) / step), 1.0, 65536.0));
+    for (int i = 1; i < n; i++) {
+        const double a = theta + delta * i / n;
+        const double ex = rx * std::cos(a), ey = ry * std::sin(a);
+        on_plot_step(movetype, point_2d_t{cos_phi * ex - sin_phi * ey + cx,
+                                   sin_phi * ex + cos_phi * ey + cy});
     }
-    if (!(pts.back() == current_point))
-        on_plot_step(movetype, pts.back());
-    return pts.back();
+    on_plot_step(movetype, end);
+    return end;
+};
+
+struct path_options_t {
+    double tolerance = 0.05; // largest distance of chords from curves
+    int verbosity = 0;       // 1 - unsupported commands, 2 - every command
 };
 
+/**
+ * where the pen is while a path is interpreted
+ */
+struct path_state_t {
+    point_2d_t current_point = {};
+    point_2d_t shape_start_point = {}; // where Z goes back to
+    point_2d_t last_control_point = {}; // of the last C, S, Q or T segment
+    char last_command = 0;              // upper case
+};
 
 /*
 
@@ -90,103 +292,298 @@ auto path_bezier_cubic = [](auto movetype, auto current_point, std::vector<doubl
     Elliptical Arc Curve: A, a
     ClosePath: Z, z
 
+    args points to count arguments of the command, which are read with a
+    cursor, without copying. Relative coordinates of every segment count
+    from the end of the previous one. S and T reflect the last control
+    point of the previous curve of their kind, as the SVG spec says.
+    Curves and arcs are flattened into chords within options.tolerance.
 */
-point_2d_t
-interpret_svg_path_command(point_2d_t current_point,
-    std::pair<char, std::vector<double>> command,
-    plot_step_callback_t on_plot_step,
-    double dt,
-    point_2d_t* current_shape_start_point)
+template <class F>
+void interpret_svg_path_command(path_state_t& state,
+    char c, const double* args, std::size_t count,
+    F& on_plot_step,
+    const path_options_t& options)
 {
-    auto& [c, args] = command;
+    auto print_command = [&]() {
+        std::cerr << c;
+        for (std::size_t i = 0; i < count; i++) {
+            std::cerr << " " << args[i];
+        }
+        std::cerr << std::endl;
+    };
+    if (options.verbosity >= 2)
+        print_command();
 
-    std::cerr << c;
-    for (auto v : args) {
-        std::cerr << " " << v;
-    }
-    std::cerr << std::endl;
-
-    if ((c == 'm') || (c == 'l') || (c == 'c') || (c == 's')) {
-        int i = 1;
-        for (auto& e : args)
-            e = e + current_point[++i % 2];
-    } else if (c == 'h') {
-        for (auto& e : args)
-            e = e + current_point[0];
-    } else if (c == 'v') {
-        for (auto& e : args)
-            e = e + current_point[1];
-    }
-    if ((c >= 'a') && (c <= 'z'))
+    const bool relative = (c >= 'a') && (c <= 'z');
+    if (relative)
         c = c - 'a' + 'A';
 
+    point_2d_t& current_point = state.current_point;
+    const double* a = args;
+    const double* const end = args + count;
+    // absolute coordinate of argument k of the current segment
+    auto x = [&](int k) { return relative ? a[k] + current_point[0] : a[k]; };
+    auto y = [&](int k) { return relative ? a[k] + current_point[1] : a[k]; };
+    // the point mirrored over the current point, if last command was one
+    // of the given kind; the current point otherwise
+    auto reflected_control = [&](char k1, char k2) {
+        if ((state.last_command != k1) && (state.last_command != k2))
+            return current_point;
+        return point_2d_t{2 * current_point[0] - state.last_control_point[0],
+            2 * current_point[1] - state.last_control_point[1]};
+    };
     switch (c) {
     case 'M': {
         step_type_e tpy = GOTO;
-        while (args.size() >= 2) {
-            current_point = path_move_to(tpy, current_point, {args.at(0), args.at(1)},
+        for (; end - a >= 2; a += 2) {
+            current_point = path_move_to(tpy, current_point, {x(0), y(1)},
                 on_plot_step);
-            args = std::vector<double>(args.begin() + 2, args.end());
             if (tpy == GOTO) {
                 tpy = PLOT;
-                *current_shape_start_point = current_point;
+                state.shape_start_point = current_point;
             }
         }
-        return current_point;
+        break;
     }
     case 'L': {
-        while (args.size() >= 2) {
+        for (; end - a >= 2; a += 2) {
             current_point = path_move_to(PLOT, current_point,
-                {args.at(0), args.at(1)}, on_plot_step);
-            args = std::vector<double>(args.begin() + 2, args.end());
+                {x(0), y(1)}, on_plot_step);
+        }
+        break;
+    }
+    case 'H': {
+        for (; end - a >= 1; a += 1) {
+            current_point = path_move_to(
+                PLOT, current_point, {x(0), current_point[1]}, on_plot_step);
+        }
+        break;
+    }
+    case 'V': {
+        for (; end - a >= 1; a += 1) {
+            current_point = path_move_to(
+                PLOT, current_point, {current_point[0], y(0)}, on_plot_step);
         }
-        return current_point;
+        break;
     }
     case 'C': {
-        while (args.size() >= 6) {
-            current_point =
-                path_bezier_cubic(PLOT, current_point, args, on_plot_step, dt);
-            args = std::vector<double>(args.begin() + 6, args.end());
+        for (; end - a >= 6; a += 6) {
+            const double segment[6] = {x(0), y(1), x(2), y(3), x(4), y(5)};
+            state.last_control_point = {segment[2], segment[3]};
+            state.last_command = 'C';
+            current_point = path_bezier_cubic(PLOT, current_point, segment,
+                on_plot_step, options.tolerance);
         }
-        return current_point;
+        break;
     }
     case 'S': {
-      //TODO: This works as a line, but shuld work as a bezier
-        while (args.size() >= 4) {
-            current_point = path_move_to(PLOT, current_point,
-                {args.at(2), args.at(3)}, on_plot_step);
-            args = std::vector<double>(args.begin() + 4, args.end());
+        for (; end - a >= 4; a += 4) {
+            const point_2d_t first = reflected_control('C', 'S');
+            const double segment[6] = {first[0], first[1], x(0), y(1), x(2), y(3)};
+            state.last_control_point = {segment[2], segment[3]};
+            state.last_command = 'S';
+            current_point = path_bezier_cubic(PLOT, current_point, segment,
+                on_plot_step, options.tolerance);
         }
-        return current_point;
+        break;
     }
-    case 'V': {
-        while (args.size() >= 1) {
-            current_point = path_move_to(
-                PLOT, current_point, {current_point[0], args.at(0)}, on_plot_step);
-            args = std::vector<double>(args.begin() + 1, args.end());
+    case 'Q': {
+        for (; end - a >= 4; a += 4) {
+            const double segment[4] = {x(0), y(1), x(2), y(3)};
+            state.last_control_point = {segment[0], segment[1]};
+            state.last_command = 'Q';
+            current_point = path_bezier_quadratic(PLOT, current_point,
+                segment, on_plot_step, options.tolerance);
         }
-        return current_point;
+        break;
     }
-    case 'H': {
-        while (args.size() >= 1) {
-            current_point = path_move_to(
-                PLOT, current_point, {args.at(0), current_point[1]}, on_plot_step);
-            args = std::vector<double>(args.begin() + 1, args.end());
+    case 'T': {
+        for (; end - a >= 2; a += 2) {
+            const point_2d_t control = reflected_control('Q', 'T');
+            const double segment[4] = {control[0], control[1], x(0), y(1)};
+            state.last_control_point = control;
+            state.last_command = 'T';
+            current_point = path_bezier_quadratic(PLOT, current_point,
+                segment, on_plot_step, options.tolerance);
         }
-        return current_point;
+        break;
+    }
+    case 'A': {
+        for (; end - a >= 7; a += 7) {
+            const double segment[7] = {a[0], a[1], a[2], a[3], a[4], x(5), y(6)};
+            current_point = path_arc(PLOT, current_point, segment,
+                on_plot_step, options.tolerance);
+        }
+        break;
     }
-    case 'z':
     case 'Z':
-        return path_move_to(PLOT, current_point, *current_shape_start_point,
-            on_plot_step);
+        current_point = path_move_to(PLOT, current_point,
+            state.shape_start_point, on_plot_step);
+        break;
     default: {
-        std::cerr << c;
-        for (auto v : args) {
-            std::cerr << " " << v;
+        if (options.verbosity >= 1)
+            print_command();
+        current_point = path_noop(current_point, on_plot_step);
+    }
+    }
+    if ((c != 'C') && (c != 'S') && (c != 'Q') && (c != 'T'))
+        state.last_command = c;
+};
+
+/**
+ * 2D affine transform, the matrix [a c e; b d f; 0 0 1] like in the svg
+ * matrix(a, b, c, d, e, f)
+ */
+struct affine_t {
+    double a = 1, b = 0, c = 0, d = 1, e = 0, f = 0;
+
+    bool is_identity() const
+    {
+        return (a == 1) && (b == 0) && (c == 0) && (d == 1) && (e == 0) &&
+               (f == 0);
+    }
+    /**
+     * the transform that applies o first, then this one
+     */
+    affine_t operator*(const affine_t& o) const
+    {
+        return {a * o.a + c * o.b, b * o.a + d * o.b,
+            a * o.c + c * o.d, b * o.c + d * o.d,
+            a * o.e + c * o.f + e, b * o.e + d * o.f + f};
+    }
+    /**
+     * the largest factor a length is scaled by: the largest singular value
+     * of the linear part
+     */
+    double max_scale() const
+    {
+        const double p = a * a + b * b + c * c + d * d;
+        const double det = a * d - b * c;
+        const double root = std::sqrt(std::max(0.0, p * p - 4 * det * det));
+        return std::sqrt((p + root) / 2);
+    }
+};
+
+/**
+ * @brief reads the transform attribute: a list of matrix, translate,
+ * scale, rotate, skewX and skewY, applied from the last one
+ *
+ * returns false (and identity in out) if the list is broken, then svg
+ * renderers ignore the attribute.
+ */
+inline bool parse_transform(std::string_view text, affine_t& out)
+{
+    out = {};
+    const char* p = text.data();
+    const char* const e = p + text.size();
+    auto skip_separators = [&]() {
+        while ((p < e) && is_path_separator(*p))
+            p++;
+    };
+    affine_t result;
+    for (skip_separators(); p < e; skip_separators()) {
+        const char* name = p;
+        while ((p < e) && (((*p | 0x20) >= 'a') && ((*p | 0x20) <= 'z')))
+            p++;
+        const std::string_view function(name, p - name);
+        skip_separators();
+        if ((p == e) || (*p != '('))
+            return false;
+        p++;
+        double v[6];
+        int n = 0;
+        for (skip_separators(); (p < e) && (*p != ')'); skip_separators())
+            if ((n == 6) || !read_number(p, e, v[n++]))
+                return false;
+        if (p == e)
+            return false;
+        p++;
+
+        affine_t m;
+        if ((function == "matrix") && (n == 6)) {
+            m = {v[0], v[1], v[2], v[3], v[4], v[5]};
+        } else if ((function == "translate") && ((n == 1) || (n == 2))) {
+            m.e = v[0];
+            m.f = (n == 2) ? v[1] : 0.0;
+        } else if ((function == "scale") && ((n == 1) || (n == 2))) {
+            m.a = v[0];
+            m.d = (n == 2) ? v[1] : v[0];
+        } else if ((function == "rotate") && ((n == 1) || (n == 3))) {
+            const double r = v[0] * M_PI / 180.0;
+            m = {std::cos(r), std::sin(r), -std::sin(r), std::cos(r), 0, 0};
+            if (n == 3) // around (cx, cy)
+                m = affine_t{1, 0, 0, 1, v[1], v[2]} * m *
+                    affine_t{1, 0, 0, 1, -v[1], -v[2]};
+        } else if ((function == "skewX") && (n == 1)) {
+            m.c = std::tan(v[0] * M_PI / 180.0);
+        } else if ((function == "skewY") && (n == 1)) {
+            m.b = std::tan(v[0] * M_PI / 180.0);
+        } else {
+            return false;
         }
-        std::cerr << std::endl;
-        return path_noop(current_point, on_plot_step);
+        result = result * m;
+    }
+    out = result;
+    return true;
+}
+
+/**
+ * @brief applies m to n points stored as x0 y0 x1 y1 ...
+ *
+ * with SSE2 one point is one register: [x y] * [a d] + [y x] * [c b] +
+ * [e f]. The operations are the same as in the plain loop, so results do
+ * not depend on the build.
+ */
+inline void transform_points(const affine_t& m, double* xy, std::size_t n)
+{
+#if defined(__SSE2__)
+    const __m128d ad = _mm_set_pd(m.d, m.a);
+    const __m128d cb = _mm_set_pd(m.b, m.c);
+    const __m128d ef = _mm_set_pd(m.f, m.e);
+    for (std::size_t i = 0; i < n; i++) {
+        const __m128d v = _mm_loadu_pd(xy + 2 * i);
+        const __m128d swapped = _mm_shuffle_pd(v, v, 1);
+        _mm_storeu_pd(xy + 2 * i,
+            _mm_add_pd(_mm_add_pd(_mm_mul_pd(v, ad), _mm_mul_pd(swapped, cb)),
+                ef));
+    }
+#else
+    for (std::size_t i = 0; i < n; i++) {
+        const double x = xy[2 * i], y = xy[2 * i + 1];
+        xy[2 * i] = x * m.a + y * m.c + m.e;
+        xy[2 * i + 1] = y * m.d + x * m.b + m.f;
     }
+#endif
+}
+
+/**
+ * flattened points of a path, collected so that the transform is applied
+ * to many of them at once
+ */
+struct point_batch_t {
+    static constexpr std::size_t capacity = 1024;
+    std::vector<double> xy; // x0 y0 x1 y1 ...
+    std::vector<step_type_e> steps;
+
+    void push(step_type_e t, point_2d_t p)
+    {
+        steps.push_back(t);
+        xy.push_back(p[0]);
+        xy.push_back(p[1]);
+    }
+    bool full() const { return steps.size() >= capacity; }
+    /**
+     * transforms the points with m and gives them to emit
+     */
+    template <class F>
+    void flush(const affine_t& m, F& emit)
+    {
+        if (!m.is_identity())
+            transform_points(m, xy.data(), steps.size());
+        for (std::size_t i = 0; i < steps.size(); i++)
+            emit(steps[i], point_2d_t{xy[2 * i], xy[2 * i + 1]});
+        xy.clear();
+        steps.clear();
     }
 };
 
@@ -194,72 +591,132 @@ int main(int argc, char** argv)
 {
     using namespace tp::xml;
     using namespace tp;
-    std::string xml_text;
-    if (argc > 1) {
-        std::ifstream t(argv[1]);
-        xml_text = std::string((std::istreambuf_iterator<char>(t)),
-            std::istreambuf_iterator<char>());
-    } else {
-        std::cout << "svg file is needed" << std::endl;
+    std::unique_ptr<mapped_file_t> input;
+    path_options_t path_options;
+    auto usage = [&](const char* message) {
+        std::cout << message << std::endl;
+        std::cout << "usage: " << argv[0]
+                  << " [-v [-v]] [-t tolerance] file.svg" << std::endl;
         return -1;
+    };
+    for (int i = 1; i < argc; i++) {
+        const std::string_view arg = argv[i];
+        if (arg == "-v") {
+            path_options.verbosity++;
+        } else if (arg == "-t") {
+            if (i + 1 >= argc)
+                return usage("missing value for -t");
+            const std::string_view t = argv[++i];
+            const char* p = t.data();
+            const char* e = t.data() + t.size();
+            if (!read_number(p, e, path_options.tolerance) || (p != e)
+                || !(path_options.tolerance > 0.0))
+                return usage("tolerance must be a positive number");
+        } else {
+            try {
+                input = std::make_unique<mapped_file_t>(argv[i]);
+            } catch (const std::system_error& e) {
+                std::cerr << argv[0] << ": " << e.what() << std::endl;
+                return 1;
+            }
+        }
     }
+    if (!input)
+        return usage("svg file is needed");
 
     double work_depth = -0.1;
     double fly_high = 10.0;
 
-    auto tree = text_to_xml_with_entities(xml_text);
-    std::map<int, std::pair<point_2d_t, point_2d_t>> shift_and_scale;
-    walk_tree(tree, [&](auto& element, auto d) {
-        if (shift_and_scale.size() == 0)
-            shift_and_scale[d] = {{0.0, 0.0}, {1.0, 1.0}};
-        else
-            shift_and_scale[d] = shift_and_scale[d - 1];
-        if (element.index() == 1) {
-            tag_t tag = std::get<1>(element);
-            if (tag.tag == "path") {
-                //        std::cout << tag.attr["d"] << std::endl;
-                auto path_commands = parse_path_to_cmnds(tag.attr["d"]);
-                point_2d_t current_point = {};
-                point_2d_t current_shape_start_point = {};
-                raspigcd::distance_t current_point_3d = {};
-                for (auto& c : path_commands) {
-                    current_point = interpret_svg_path_command(
-                        current_point, c,
-                        [&](step_type_e sttp, point_2d_t p) {
-                            if (true)
-                                switch (sttp) {
-                                case GOTO:
-                                    if (!(current_point == p)) {
-                                        std::cout << "G0Z" << fly_high << std::endl;
-                                        std::cout << "G0"
-                                                  << "X" << p[0] << "Y" << -p[1] << std::endl;
-                                        std::cout << "G0"
-                                                  << "Z" << 0.0 << std::endl;
-                                        current_point_3d[2] = 0.0;
-                                    }
-                                    break;
-                                case PLOT:
-                                    if (!(current_point == p)) {
-                                        if (current_point_3d[2] > work_depth) {
-                                            std::cout << "G1"
-                                                      << "Z" << work_depth << std::endl;
-                                            current_point_3d[2] = work_depth;
-                                        }
-                                        std::cout << "G1"
-                                                  << "X" << p[0] << "Y" << -p[1] << std::endl;
-                                    }
-                                    break;
-                                }
-                            current_point = p;
-                            current_point_3d[0] = current_point[0];
-                            current_point_3d[1] = current_point[1];
-                        },
-                        0.05, &current_shape_start_point);
+    output_sink_t gcode(STDOUT_FILENO);
+    auto tree = text_to_xml_with_entities(input->view());
+    const name_t path_name("path");
+    const name_t d_name("d");
+    const name_t transform_name("transform");
+    path_data_t path;
+    point_batch_t batch;
+    auto plot_path = [&](const tag_t& tag, const affine_t& transform) {
+        auto d = tag.attr.find(d_name);
+        path.clear();
+        if ((d != tag.attr.end()) && !parse_path_data(d->second, path))
+            std::cerr << "svg path: error in path data, ignoring the rest"
+                      << std::endl;
+        point_2d_t current_point = {};
+        raspigcd::distance_t current_point_3d = {};
+        // gets points after the transform
+        auto emit = [&](step_type_e sttp, point_2d_t p) {
+            switch (sttp) {
+            case GOTO:
+                if (!(current_point == p)) {
+                    gcode << "G0Z" << fly_high << '\n';
+                    gcode << "G0"
+                          << "X" << p[0] << "Y" << -p[1] << '\n';
+                    gcode << "G0"
+                          << "Z" << 0.0 << '\n';
+                    current_point_3d[2] = 0.0;
+                }
+                break;
+            case PLOT:
+                if (!(current_point == p)) {
+                    if (current_point_3d[2] > work_depth) {
+                        gcode << "G1"
+                              << "Z" << work_depth << '\n';
+                        current_point_3d[2] = work_depth;
+                    }
+                    gcode << "G1"
+                          << "X" << p[0] << "Y" << -p[1] << '\n';
                 }
-                std::cout << std::endl;
+                break;
+            default:
+                break;
             }
+            current_point = p;
+            current_point_3d[0] = current_point[0];
+            current_point_3d[1] = current_point[1];
+        };
+        auto on_plot_step = [&](step_type_e sttp, point_2d_t p) {
+            batch.push(sttp, p);
+            if (batch.full())
+                batch.flush(transform, emit);
+        };
+        // the curves are flattened before the transform, so the tolerance
+        // is shrunk by the largest scale the transform applies
+        path_options_t options = path_options;
+        const double scale = transform.max_scale();
+        if (scale > 0.0)
+            options.tolerance /= scale;
+        path_state_t state;
+        for (auto& cmd : path.commands) {
+            interpret_svg_path_command(state, cmd.c, path.arguments(cmd),
+                cmd.count, on_plot_step, options);
         }
-    });
+        batch.flush(transform, emit);
+        gcode << '\n';
+    };
+
+    // transforms of the open elements, composed from the root down
+    std::vector<affine_t> transforms = {affine_t{}};
+    walk_tree_io(
+        tree,
+        [&](const element_t& element, int) {
+            affine_t m = transforms.back();
+            if (std::holds_alternative<tag_t>(element)) {
+                const tag_t& tag = std::get<tag_t>(element);
+                auto t = tag.attr.find(transform_name);
+                affine_t local;
+                if (t != tag.attr.end()) {
+                    if (parse_transform(t->second, local))
+                        m = m * local;
+                    else
+                        std::cerr << "svg: bad transform \"" << t->second
+                                  << "\", ignored" << std::endl;
+                }
+                if (tag.tag == path_name)
+                    plot_path(tag, m);
+            }
+            transforms.push_back(m);
+        },
+        [&](const element_t&, int) { transforms.pop_back(); });
+    gcode.flush();
     // print_tree(text_to_xml_with_entities(xml_text));
 
     return -0;
@@ -0,0 +1,123 @@
+
+/*
+TYPES:
+
+class mapped_file_t {
+public:
+  explicit mapped_file_t(const std::string &path); // "-" is stdin
+  std::string_view view() const;
+  bool is_mapped() const;
+};
+
+Regular files are mapped read-only with sequential access hint, so the
+parser works directly on the page cache. Pipes, character devices and stdin
+cannot be mapped and are read in chunks into a buffer instead.
+
+*/
+
+#ifndef __TP_MAPPED_FILE_HPP__
+#define __TP_MAPPED_FILE_HPP__
+
+#include <cerrno>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tp {
+
+class mapped_file_t {
+public:
+  explicit mapped_file_t(const std::string &path) {
+    int fd = (path == "-") ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), path);
+    try {
+      struct stat st;
+      if (::fstat(fd, &st) != 0)
+        throw std::system_error(errno, std::generic_category(), path);
+      if (S_ISREG(st.st_mode) && (st.st_size > 0) && map_file(fd, st.st_size)) {
+        ::madvise(map, map_size, MADV_SEQUENTIAL);
+      } else {
+        read_all(fd, path);
+      }
+    } catch (...) {
+      if (fd != STDIN_FILENO)
+        ::close(fd);
+      throw;
+    }
+    if (fd != STDIN_FILENO)
+      ::close(fd);
+  }
+
+  mapped_file_t(const mapped_file_t &) = delete;
+  mapped_file_t &operator=(const mapped_file_t &) = delete;
+  mapped_file_t(mapped_file_t &&other) noexcept
+      : map(other.map), map_size(other.map_size),
+        buffer(std::move(other.buffer)) {
+    other.map = nullptr;
+    other.map_size = 0;
+  }
+  mapped_file_t &operator=(mapped_file_t &&other) noexcept {
+    std::swap(map, other.map);
+    std::swap(map_size, other.map_size);
+    std::swap(buffer, other.buffer);
+    return *this;
+  }
+  ~mapped_file_t() {
+    if (map)
+      ::munmap(map, map_size);
+  }
+
+  /**
+   * contents of the file. Valid as long as this object lives.
+   */
+  std::string_view view() const {
+    if (map)
+      return {static_cast<const char *>(map), map_size};
+    return buffer;
+  }
+
+  bool is_mapped() const { return map != nullptr; }
+
+private:
+  void *map = nullptr;
+  std::size_t map_size = 0;
+  std::string buffer;
+
+  bool map_file(int fd, std::size_t size) {
+    void *m = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED)
+      return false;
+    map = m;
+    map_size = size;
+    return true;
+  }
+
+  void read_all(int fd, const std::string &path) {
+    static constexpr std::size_t chunk_size = 64 * 1024;
+    std::size_t size = 0;
+    for (;;) {
+      buffer.resize(size + chunk_size);
+      auto n = ::read(fd, buffer.data() + size, chunk_size);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        throw std::system_error(errno, std::generic_category(), path);
+      }
+      if (n == 0)
+        break;
+      size += n;
+    }
+    buffer.resize(size);
+  }
+};
+
+} // namespace tp
+
+#endif
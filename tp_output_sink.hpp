@@ -0,0 +1,181 @@
+
+/*
+TYPES:
+
+class output_sink_t {
+public:
+  explicit output_sink_t(int fd);           // write(2) to the descriptor
+  explicit output_sink_t(std::ostream &o);  // o.write
+  explicit output_sink_t(std::string &s);   // appends to s
+  void write(std::string_view s);
+  void put(char c);
+  void flush();
+  output_sink_t &operator<<(...); // strings, characters and numbers
+};
+
+Output is collected in one block (256KiB by default) and handed to the
+target only when the block is full, on flush() and in the destructor. Data
+bigger than the block goes straight to the target. Nothing is allocated
+after construction. Numbers are formatted with std::to_chars straight into
+the block; floating point numbers look like the ostream default (%g).
+
+*/
+
+#ifndef __TP_OUTPUT_SINK_HPP__
+#define __TP_OUTPUT_SINK_HPP__
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+#include <unistd.h>
+
+namespace tp {
+
+class output_sink_t {
+public:
+  static constexpr std::size_t default_block_size = 256 * 1024;
+
+  explicit output_sink_t(int fd, std::size_t block_size = default_block_size)
+      : output_sink_t(block_size) {
+    fd_target = fd;
+  }
+  explicit output_sink_t(std::ostream &o,
+                         std::size_t block_size = default_block_size)
+      : output_sink_t(block_size) {
+    stream_target = &o;
+  }
+  explicit output_sink_t(std::string &s,
+                         std::size_t block_size = default_block_size)
+      : output_sink_t(block_size) {
+    string_target = &s;
+  }
+
+  output_sink_t(const output_sink_t &) = delete;
+  output_sink_t &operator=(const output_sink_t &) = delete;
+
+  /**
+   * flushes what is left. Errors are lost here, call flush() to see them.
+   */
+  ~output_sink_t() {
+    try {
+      flush();
+    } catch (...) {
+    }
+  }
+
+  void write(std::string_view s) {
+    if (s.size() <= std::size_t(end - current)) {
+      std::memcpy(current, s.data(), s.size());
+      current += s.size();
+      return;
+    }
+    flush();
+    if (s.size() < block_size) {
+      std::memcpy(current, s.data(), s.size());
+      current += s.size();
+    } else {
+      send(s.data(), s.size());
+    }
+  }
+
+  void put(char c) {
+    if (current == end)
+      flush();
+    *current++ = c;
+  }
+
+  /**
+   * writes the number like std::ostream with default settings does
+   */
+  template <class N> void write_number(N v) {
+    static constexpr std::size_t max_number_size = 32;
+    if (std::size_t(end - current) < max_number_size)
+      flush();
+    std::to_chars_result r;
+    if constexpr (std::is_floating_point_v<N>)
+      r = std::to_chars(current, end, v, std::chars_format::general, 6);
+    else
+      r = std::to_chars(current, end, v);
+    current = r.ptr;
+  }
+
+  output_sink_t &operator<<(std::string_view s) {
+    write(s);
+    return *this;
+  }
+  output_sink_t &operator<<(const char *s) {
+    write(s);
+    return *this;
+  }
+  output_sink_t &operator<<(char c) {
+    put(c);
+    return *this;
+  }
+  template <class N>
+  std::enable_if_t<std::is_arithmetic_v<N>, output_sink_t &> operator<<(N v) {
+    write_number(v);
+    return *this;
+  }
+
+  /**
+   * hands the collected data to the target (and flushes the ostream)
+   */
+  void flush() {
+    const std::size_t n = current - block.get();
+    current = block.get();
+    if (n)
+      send(block.get(), n);
+    if (stream_target)
+      stream_target->flush();
+  }
+
+private:
+  std::size_t block_size;
+  std::unique_ptr<char[]> block;
+  char *current;
+  char *end;
+
+  int fd_target = -1;
+  std::ostream *stream_target = nullptr;
+  std::string *string_target = nullptr;
+
+  explicit output_sink_t(std::size_t block_size)
+      : block_size(std::max<std::size_t>(block_size, 64)),
+        block(new char[this->block_size]), current(block.get()),
+        end(block.get() + this->block_size) {}
+
+  void send(const char *p, std::size_t n) {
+    if (string_target) {
+      string_target->append(p, n);
+    } else if (stream_target) {
+      stream_target->write(p, n);
+      if (!*stream_target)
+        throw std::system_error(std::make_error_code(std::errc::io_error),
+                                "output_sink_t");
+    } else {
+      while (n) {
+        auto r = ::write(fd_target, p, n);
+        if (r < 0) {
+          if (errno == EINTR)
+            continue;
+          throw std::system_error(errno, std::generic_category(),
+                                  "output_sink_t write");
+        }
+        p += r;
+        n -= r;
+      }
+    }
+  }
+};
+
+} // namespace tp
+
+#endif
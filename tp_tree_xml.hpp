@@ -2,63 +2,195 @@
 /*
 TYPES:
 
-template <class T> class tree_elem_t {
+template <class T, class A = std::allocator<T>> class tree_elem_t {
 public:
   T value;
-  std::list<tree_elem_t> children;
+  std::list<tree_elem_t, rebind_alloc<A, tree_elem_t>> children;
 };
 
-struct tag_t {
-  std::map<std::string, std::string> attr;
-  std::string tag;
+class name_t;  // interned name, compares as one integer
+template <class S> class basic_attr_list_t; // (name_t, S) pairs, 4 inline
+template <class L> struct basic_tag_t {
+  L attr;
+  name_t tag;
 };
+
+using attr_list_t = basic_attr_list_t<std::string>;
+using tag_t = basic_tag_t<attr_list_t>;
 using text_t = std::string;
 using element_t = std::variant<text_t, tag_t>; // element variant
 
+namespace pmr { // the same with std::pmr strings and lists
+using text_t = std::pmr::string;
+using attr_list_t = basic_attr_list_t<text_t>;
+using tag_t = basic_tag_t<attr_list_t>;
+using element_t = std::variant<text_t, tag_t>;
+using tree_t = tree_elem_t<element_t, std::pmr::polymorphic_allocator<element_t>>;
+class document_t; // tree_t that lives in one monotonic_buffer_resource
+}
+
+class flat_document_t; // nodes in one vector, strings in arena_t
+
+class lazy_text_t; // raw text, entities decoded on first str()
+class lazy_tag_t;  // raw tag, attributes parsed on first attr(name_t)
+using lazy_element_t = std::variant<lazy_text_t, lazy_tag_t>;
+
 FUNCTIONS:
 
-inline tree_elem_t<element_t> text_to_xml(const std::string &xml_text);
-inline tree_elem_t<element_t> text_to_xml_with_entities(const std::string
-&xml_text);
+template <class R = tree_elem_t<element_t>>
+inline R text_to_xml(std::string_view xml_text);
+template <class R = tree_elem_t<element_t>>
+inline R text_to_xml_with_entities(std::string_view xml_text);
+
+where R is tree_elem_t<element_t>, flat_document_t,
+tree_elem_t<lazy_element_t> (keeps views into xml_text) or pmr::tree_t (in
+the default memory resource)
+
+inline pmr::tree_t text_to_xml(std::string_view xml_text,
+                               std::pmr::memory_resource *resource);
+inline pmr::tree_t text_to_xml_with_entities(std::string_view xml_text,
+                                             std::pmr::memory_resource *resource);
 
 */
 
+#ifndef __TP_TREE_XML_HPP__
+#define __TP_TREE_XML_HPP__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <list>
 #include <map>
-#include <regex>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
 #include <streambuf>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
+#include <tp_output_sink.hpp>
+
+#if !defined(TP_XML_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define TP_XML_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
 namespace tp {
 
-template <class T> class tree_elem_t {
+/**
+ * node of a tree. A allocates the children lists; with
+ * std::pmr::polymorphic_allocator the whole tree can live in one memory
+ * resource (see xml::pmr::document_t).
+ * */
+template <class T, class A = std::allocator<T>> class tree_elem_t {
 public:
   T value;
-  std::list<tree_elem_t> children;
+  std::list<tree_elem_t, typename std::allocator_traits<
+                             A>::template rebind_alloc<tree_elem_t>>
+      children;
 };
 
+/**
+ * what walk_tree should do after the callback. Callbacks may also return
+ * void, which means WALK_CONTINUE.
+ * */
+enum walk_e { WALK_CONTINUE,
+              WALK_SKIP_CHILDREN,
+              WALK_STOP };
+
+template <class F, class V>
+inline walk_e walk_callback(F &f, V &value, int d) {
+  if constexpr (std::is_void_v<std::invoke_result_t<F &, V &, int>>) {
+    f(value, d);
+    return WALK_CONTINUE;
+  } else {
+    return f(value, d);
+  }
+}
+
 /**
  * t - tree root
  * f - callback on element
  * d - depth in tree
+ *
+ * iterative, so the depth of the tree is limited only by memory. f can
+ * return walk_e to skip children of the element or to stop the walk.
  * */
-auto walk_tree = [](auto &t, auto f, int d = 0) -> void {
-  f(t.value, d);
-  for (const auto &e : t.children) {
-    walk_tree(e, f, d + 1);
+template <class T, class F> inline void walk_tree(T &t, F f, int d = 0) {
+  if (walk_callback(f, t.value, d) != WALK_CONTINUE)
+    return;
+  using iterator_t = decltype(t.children.begin());
+  std::vector<std::pair<iterator_t, iterator_t>> stack;
+  stack.reserve(32);
+  stack.push_back({t.children.begin(), t.children.end()});
+  while (!stack.empty()) {
+    auto &[it, end] = stack.back();
+    if (it == end) {
+      stack.pop_back();
+      continue;
+    }
+    auto &e = *(it++);
+    auto r = walk_callback(f, e.value, d + int(stack.size()));
+    if (r == WALK_STOP)
+      return;
+    if ((r == WALK_CONTINUE) && !e.children.empty())
+      stack.push_back({e.children.begin(), e.children.end()});
   }
-};
-auto walk_tree_io = [](auto &t, auto f_pre, auto f_post, int d = 0) -> void {
-  f_pre(t.value, d);
-  for (const auto &e : t.children) {
-    walk_tree_io(e, f_pre, f_post, d + 1);
+}
+
+/**
+ * like walk_tree, with f_pre called before and f_post after the children.
+ * f_post is called also when f_pre skipped the children. WALK_STOP from any
+ * of them ends the walk at once, without f_post for the open elements.
+ * */
+template <class T, class F_PRE, class F_POST>
+inline void walk_tree_io(T &t, F_PRE f_pre, F_POST f_post, int d = 0) {
+  using node_t = std::remove_reference_t<decltype(*t.children.begin())>;
+  using iterator_t = decltype(t.children.begin());
+  struct frame_t {
+    decltype((t.value)) value;
+    iterator_t it, end;
+  };
+  auto r = walk_callback(f_pre, t.value, d);
+  if (r == WALK_STOP)
+    return;
+  std::vector<frame_t> stack;
+  stack.reserve(32);
+  if (r == WALK_CONTINUE)
+    stack.push_back({t.value, t.children.begin(), t.children.end()});
+  else if (walk_callback(f_post, t.value, d) == WALK_STOP)
+    return;
+  while (!stack.empty()) {
+    auto &top = stack.back();
+    if (top.it == top.end) {
+      auto &value = top.value;
+      stack.pop_back();
+      if (walk_callback(f_post, value, d + int(stack.size())) == WALK_STOP)
+        return;
+      continue;
+    }
+    node_t &e = *(top.it++);
+    const int depth = d + int(stack.size());
+    r = walk_callback(f_pre, e.value, depth);
+    if (r == WALK_STOP)
+      return;
+    if (r == WALK_CONTINUE)
+      stack.push_back({e.value, e.children.begin(), e.children.end()});
+    else if (walk_callback(f_post, e.value, depth) == WALK_STOP)
+      return;
   }
-  f_post(t.value, d);
-};
+}
 
 /**
  * transform one type to another inside tree
@@ -84,27 +216,379 @@ inline tree_elem_t<D> transform_tree(const tree_elem_t<T> &t,
   return ret;
 }
 
-auto print_tree = [](auto elements) {
-  walk_tree(elements, [](auto &a, auto d) {
+/**
+ * prints one node per line, indented with dots. Output goes through one
+ * buffered output_sink_t and is flushed once at the end.
+ * */
+auto print_tree = [](const auto &elements) {
+  output_sink_t out(std::cout);
+  walk_tree(elements, [&](const auto &a, auto d) {
     for (int i = 0; i < d; i++)
-      std::cout << ".\t";
-    std::cout << a << std::endl;
+      out << ".\t";
+    out << a << '\n';
   });
 };
 
+/**
+ * vector that keeps the first N elements inside the object and goes to the
+ * heap (of allocator A) only when it grows bigger. Elements are made with
+ * std::allocator_traits<A>::construct, so with a polymorphic_allocator they
+ * take the memory resource too.
+ * */
+template <class T, std::size_t N, class A = std::allocator<T>>
+class small_vector_t : private A {
+public:
+  using allocator_type = A;
+
+  small_vector_t() = default;
+  explicit small_vector_t(const A &a) : A(a) {}
+  small_vector_t(const small_vector_t &o)
+      : A(std::allocator_traits<A>::select_on_container_copy_construction(
+            o.get_allocator())) {
+    reserve(o.count);
+    for (auto &e : o)
+      push_back(e);
+  }
+  small_vector_t(small_vector_t &&o) noexcept(
+      std::is_nothrow_move_constructible_v<T>)
+      : A(o.get_allocator()) {
+    take(std::move(o));
+  }
+  small_vector_t &operator=(const small_vector_t &o) {
+    if (this != &o) {
+      clear();
+      reserve(o.count);
+      for (auto &e : o)
+        push_back(e);
+    }
+    return *this;
+  }
+  /**
+   * the allocator stays, elements are moved one by one if the allocators
+   * differ
+   */
+  small_vector_t &operator=(small_vector_t &&o) {
+    if (this != &o) {
+      clear();
+      if (get_allocator() == o.get_allocator()) {
+        release();
+        take(std::move(o));
+      } else {
+        reserve(o.count);
+        for (auto &e : o)
+          push_back(std::move(e));
+        o.clear();
+      }
+    }
+    return *this;
+  }
+  ~small_vector_t() {
+    clear();
+    release();
+  }
+
+  A get_allocator() const { return *this; }
+
+  T *begin() { return items; }
+  T *end() { return items + count; }
+  const T *begin() const { return items; }
+  const T *end() const { return items + count; }
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  T &operator[](std::size_t i) { return items[i]; }
+  const T &operator[](std::size_t i) const { return items[i]; }
+  T &back() { return items[count - 1]; }
+
+  template <class... V> T &emplace_back(V &&...args) {
+    if (count == capacity)
+      reserve(capacity * 2);
+    std::allocator_traits<A>::construct(allocator(), items + count,
+                                        std::forward<V>(args)...);
+    return items[count++];
+  }
+  void push_back(const T &v) { emplace_back(v); }
+  void push_back(T &&v) { emplace_back(std::move(v)); }
+  void clear() {
+    for (std::size_t i = 0; i < count; i++)
+      std::allocator_traits<A>::destroy(allocator(), items + i);
+    count = 0;
+  }
+  void reserve(std::size_t n) {
+    if (n <= capacity)
+      return;
+    T *bigger = std::allocator_traits<A>::allocate(allocator(), n);
+    for (std::size_t i = 0; i < count; i++) {
+      std::allocator_traits<A>::construct(allocator(), bigger + i,
+                                          std::move(items[i]));
+      std::allocator_traits<A>::destroy(allocator(), items + i);
+    }
+    release();
+    items = bigger;
+    capacity = n;
+  }
+
+private:
+  alignas(T) unsigned char storage[N * sizeof(T)];
+  T *items = local();
+  std::size_t count = 0;
+  std::size_t capacity = N;
+
+  A &allocator() { return *this; }
+  T *local() { return reinterpret_cast<T *>(storage); }
+  bool is_inline() const {
+    return items == reinterpret_cast<const T *>(storage);
+  }
+  void release() {
+    if (!is_inline())
+      std::allocator_traits<A>::deallocate(allocator(), items, capacity);
+    items = local();
+    capacity = N;
+  }
+  /**
+   * moves the elements of o, which has the same allocator, into this empty
+   * vector
+   */
+  void take(small_vector_t &&o) {
+    if (o.is_inline()) {
+      for (auto &e : o)
+        push_back(std::move(e));
+      o.clear();
+    } else {
+      items = o.items;
+      count = o.count;
+      capacity = o.capacity;
+      o.items = o.local();
+      o.count = 0;
+      o.capacity = N;
+    }
+  }
+};
+
 namespace xml {
 
-struct tag_t {
-  std::map<std::string, std::string> attr;
-  std::string tag;
+/**
+ * @brief process wide table of interned tag and attribute names
+ *
+ * every distinct name is stored once and identified by its index (atom).
+ * Atoms never change, so names can be compared as integers. Atom 0 is the
+ * empty name. Safe to use from many threads.
+ * */
+class name_table_t {
+public:
+  static name_table_t &global() {
+    static name_table_t table;
+    return table;
+  }
+
+  std::uint32_t intern(std::string_view s) {
+    // names already seen by this thread are found without touching the lock,
+    // which matters when many threads parse at once
+    thread_local std::unordered_map<std::string_view, std::uint32_t> cache;
+    auto cached = cache.find(s);
+    if (cached != cache.end())
+      return cached->second;
+    std::uint32_t atom = intern_shared(s);
+    cache.emplace(str(atom), atom);
+    return atom;
+  }
+
+  std::string_view str(std::uint32_t atom) const {
+    // interned strings never move, so every thread keeps its own copy of the
+    // pointers and takes the lock only for atoms made since its last copy
+    thread_local std::vector<const std::string *> cache;
+    if (atom >= cache.size()) {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      for (std::size_t i = cache.size(); i < names.size(); i++)
+        cache.push_back(names[i].get());
+    }
+    return *cache[atom];
+  }
+
+private:
+  // atom 0 is the empty name, atom 1 stands for all <!...> and <?...?>
+  // markup, which is never interned
+  name_table_t() {
+    intern_shared({});
+    intern_shared("<>");
+  }
+
+  std::uint32_t intern_shared(std::string_view s) {
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      auto found = index.find(s);
+      if (found != index.end())
+        return found->second;
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto found = index.find(s);
+    if (found != index.end())
+      return found->second;
+    auto atom = static_cast<std::uint32_t>(names.size());
+    names.push_back(std::make_unique<std::string>(s));
+    index.emplace(*names.back(), atom);
+    return atom;
+  }
+
+  mutable std::shared_mutex mutex;
+  std::vector<std::unique_ptr<std::string>> names;
+  std::unordered_map<std::string_view, std::uint32_t> index;
+};
+
+/**
+ * interned name. Keep frequently compared names in constants, for example
+ * static const name_t path_name("path"); then tag.tag == path_name compares
+ * two integers.
+ * */
+class name_t {
+public:
+  std::uint32_t atom = 0;
+
+  name_t() = default;
+  explicit name_t(std::string_view s)
+      : atom(name_table_t::global().intern(s)) {}
+  explicit name_t(const std::string &s) : name_t(std::string_view(s)) {}
+  explicit name_t(const char *s) : name_t(std::string_view(s)) {}
+
+  /**
+   * name of every <!DOCTYPE ...> and <?xml ...?> tag. Their text is not
+   * interned (it would fill the table that never shrinks), tags keep it
+   * themselves, see basic_tag_t::markup()
+   */
+  static name_t markup() {
+    name_t n;
+    n.atom = 1;
+    return n;
+  }
+
+  std::string_view str() const { return name_table_t::global().str(atom); }
+  bool empty() const { return atom == 0; }
 };
+
+inline bool operator==(name_t a, name_t b) { return a.atom == b.atom; }
+inline bool operator!=(name_t a, name_t b) { return a.atom != b.atom; }
+// comparing with a plain string does not intern it
+inline bool operator==(name_t a, std::string_view b) { return a.str() == b; }
+inline bool operator==(name_t a, const char *b) {
+  return a.str() == std::string_view(b);
+}
+inline bool operator!=(name_t a, std::string_view b) { return !(a == b); }
+inline bool operator!=(name_t a, const char *b) { return !(a == b); }
+/**
+ * result type of the printers below, which write to std::ostream or to
+ * output_sink_t
+ * */
+template <class O>
+using if_output_t = std::enable_if_t<std::is_base_of_v<std::ostream, O> ||
+                                         std::is_same_v<O, output_sink_t>,
+                                     O &>;
+
+// N is deduced, so string literals do not convert to name_t here
+template <class O, class N,
+          class = std::enable_if_t<std::is_same_v<N, name_t>>>
+inline if_output_t<O> operator<<(O &o, const N &n) {
+  o << n.str();
+  return o;
+}
+
+/**
+ * attributes of one tag in document order. Lookup is a linear scan over
+ * integer atoms, which for the usual handful of attributes is faster than
+ * any map. S is the string type of values; the list and new values use its
+ * allocator.
+ * */
+template <class S> class basic_attr_list_t {
+public:
+  using value_type = std::pair<name_t, S>;
+  using allocator_type = typename std::allocator_traits<
+      typename S::allocator_type>::template rebind_alloc<value_type>;
+
+  basic_attr_list_t() = default;
+  explicit basic_attr_list_t(const allocator_type &a) : items(a) {}
+
+  allocator_type get_allocator() const { return items.get_allocator(); }
+
+  value_type *begin() { return items.begin(); }
+  value_type *end() { return items.end(); }
+  const value_type *begin() const { return items.begin(); }
+  const value_type *end() const { return items.end(); }
+  std::size_t size() const { return items.size(); }
+  bool empty() const { return items.empty(); }
+
+  value_type *find(name_t name) {
+    for (auto &e : items)
+      if (e.first == name)
+        return &e;
+    return end();
+  }
+  const value_type *find(name_t name) const {
+    for (auto &e : items)
+      if (e.first == name)
+        return &e;
+    return end();
+  }
+  std::size_t count(name_t name) const { return (find(name) == end()) ? 0 : 1; }
+  const S &at(name_t name) const {
+    auto found = find(name);
+    if (found == end())
+      throw std::out_of_range("no attribute " + std::string(name.str()));
+    return found->second;
+  }
+  /**
+   * value of the attribute, added empty if it was not there
+   */
+  S &operator[](name_t name) {
+    auto found = find(name);
+    if (found != end())
+      return found->second;
+    return items.emplace_back(name, S()).second;
+  }
+
+private:
+  small_vector_t<value_type, 4, allocator_type> items;
+};
+
+template <class L> struct basic_tag_t {
+  L attr;
+  name_t tag;
+
+  bool is_markup() const { return tag == name_t::markup(); }
+  /**
+   * text of <!...> or <?...?> markup, kept as the value of the only
+   * attribute, also named name_t::markup(). Empty for elements.
+   */
+  std::string_view markup() const {
+    if (!is_markup() || attr.empty())
+      return {};
+    return attr.begin()->second;
+  }
+};
+
+using attr_list_t = basic_attr_list_t<std::string>;
+using tag_t = basic_tag_t<attr_list_t>;
 using text_t = std::string;
 using element_t = std::variant<text_t, tag_t>; // element variant
 
-inline std::ostream &operator<<(std::ostream &o, const element_t &e) {
+/**
+ * the same types with std::pmr strings and lists, for trees that are built
+ * in one memory resource and freed with it
+ * */
+namespace pmr {
+using text_t = std::pmr::string;
+using attr_list_t = basic_attr_list_t<text_t>;
+using tag_t = basic_tag_t<attr_list_t>;
+using element_t = std::variant<text_t, tag_t>;
+using tree_t =
+    tree_elem_t<element_t, std::pmr::polymorphic_allocator<element_t>>;
+} // namespace pmr
+
+template <class O, class S, class L>
+inline if_output_t<O> operator<<(O &o,
+                                 const std::variant<S, basic_tag_t<L>> &e) {
   //    o << "<(" << e.type << ")" << e.tag << ">" << e.value;
   if (e.index() == 0) {
     o << "" << std::get<0>(e) << "";
+  } else if (std::get<1>(e).is_markup()) {
+    o << "<\033[34m" << std::get<1>(e).markup() << "\033[0m>";
   } else {
     o << "<\033[34m" << std::get<1>(e).tag << "\033[0m";
     for (auto &[k, v] : std::get<1>(e).attr) {
@@ -115,229 +599,1260 @@ inline std::ostream &operator<<(std::ostream &o, const element_t &e) {
   return o;
 }
 
+/**
+ * error in xml structure. offset is the byte position in the parsed text.
+ */
+class parse_error : public std::runtime_error {
+public:
+  std::size_t offset;
+  parse_error(const std::string &what, std::size_t offset)
+      : std::runtime_error(what + " at byte " + std::to_string(offset)),
+        offset(offset) {}
+};
+
+/**
+ * bump allocator for strings of one document. Everything is freed together
+ * with the arena.
+ */
+class arena_t {
+public:
+  explicit arena_t(std::size_t block_size = 64 * 1024)
+      : block_size(block_size) {}
+
+  char *allocate(std::size_t n) {
+    if (n > left) {
+      std::size_t size = std::max(n, block_size);
+      blocks.push_back(std::make_unique<char[]>(size));
+      current = blocks.back().get();
+      left = size;
+    }
+    char *ret = current;
+    current += n;
+    left -= n;
+    return ret;
+  }
+
+  std::string_view store(std::string_view s) {
+    if (s.empty())
+      return {};
+    char *dst = allocate(s.size());
+    std::copy(s.begin(), s.end(), dst);
+    return {dst, s.size()};
+  }
+
+private:
+  std::vector<std::unique_ptr<char[]>> blocks;
+  std::size_t block_size;
+  char *current = nullptr;
+  std::size_t left = 0;
+};
+
+struct flat_attr_t {
+  std::string_view name;
+  std::string_view value;
+};
+
+/**
+ * one node of flat_document_t. value is the tag name for tags and the text
+ * for text nodes. Children form a singly linked list of indices.
+ * */
+struct flat_node_t {
+  static constexpr std::uint32_t npos = ~std::uint32_t(0);
+  std::string_view value;
+  std::uint32_t first_child = npos;
+  std::uint32_t next_sibling = npos;
+  std::uint32_t attr_begin = 0;
+  std::uint32_t attr_count = 0;
+  bool is_tag = false;
+};
+
+/**
+ * parsed xml document stored in one contiguous vector of nodes. nodes[0] is
+ * the root (empty text, like the root of tree_elem_t<element_t>). Names, text
+ * and attribute values live in the arena, so the document does not depend on
+ * the source text.
+ * */
+class flat_document_t {
+public:
+  std::vector<flat_node_t> nodes;
+  std::vector<flat_attr_t> attrs;
+  arena_t arena;
+};
+
+/**
+ * lightweight view of one node of flat_document_t, passed to the walk_tree
+ * callbacks. Mimics element_t: index() is 0 for text and 1 for tags.
+ * */
+class flat_element_t {
+public:
+  const flat_document_t *doc;
+  std::uint32_t node;
+
+  const flat_node_t &get() const { return doc->nodes[node]; }
+  std::size_t index() const { return get().is_tag ? 1 : 0; }
+  std::string_view text() const { return get().value; }
+  std::string_view tag() const { return get().value; }
+  const flat_attr_t *attr_begin() const {
+    return doc->attrs.data() + get().attr_begin;
+  }
+  const flat_attr_t *attr_end() const {
+    return attr_begin() + get().attr_count;
+  }
+  /**
+   * value of the attribute, or empty view if there is no such attribute
+   */
+  std::string_view attr(std::string_view name) const {
+    for (auto a = attr_begin(); a != attr_end(); ++a)
+      if (a->name == name)
+        return a->value;
+    return {};
+  }
+};
+
+template <class O>
+inline if_output_t<O> operator<<(O &o, const flat_element_t &e) {
+  if (e.index() == 0) {
+    o << e.text();
+  } else {
+    o << "<\033[34m" << e.tag() << "\033[0m";
+    for (auto a = e.attr_begin(); a != e.attr_end(); ++a) {
+      o << " \033[31m" << a->name << "\033[0m=\033[32m" << a->value
+        << "\033[0m";
+    }
+    o << ">";
+  }
+  return o;
+}
+
 namespace helpers {
 /**
- * @brief parses xml string into tree of strings - elements in < and >, and
- * other parts
+ * delimiter scanning kernels. find_any_of returns the first position in
+ * [p, e) holding one of the four characters (repeat a character to look for
+ * fewer), or e. On x86 it checks 32 (AVX2) or 16 (SSE2) bytes per step,
+ * selected once at run time; define TP_XML_NO_SIMD to use the scalar loop
+ * only.
+ * */
+namespace simd {
+
+using find_any_of_t = const char *(*)(const char *, const char *, char, char,
+                                      char, char);
+
+inline const char *find_any_of_scalar(const char *p, const char *e, char a,
+                                      char b, char c, char d) {
+  for (; p < e; ++p) {
+    const char x = *p;
+    if ((x == a) || (x == b) || (x == c) || (x == d))
+      return p;
+  }
+  return e;
+}
+
+#ifdef TP_XML_X86_SIMD
+inline const char *find_any_of_sse2(const char *p, const char *e, char a,
+                                    char b, char c, char d) {
+  const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b),
+                vc = _mm_set1_epi8(c), vd = _mm_set1_epi8(d);
+  for (; e - p >= 16; p += 16) {
+    const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    const __m128i m =
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb)),
+                     _mm_or_si128(_mm_cmpeq_epi8(x, vc), _mm_cmpeq_epi8(x, vd)));
+    const int mask = _mm_movemask_epi8(m);
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return find_any_of_scalar(p, e, a, b, c, d);
+}
+
+__attribute__((target("avx2"))) inline const char *
+find_any_of_avx2(const char *p, const char *e, char a, char b, char c, char d) {
+  const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b),
+                vc = _mm256_set1_epi8(c), vd = _mm256_set1_epi8(d);
+  for (; e - p >= 32; p += 32) {
+    const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    const __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, vc), _mm256_cmpeq_epi8(x, vd)));
+    const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(m));
+    if (mask)
+      return p + __builtin_ctz(mask);
+  }
+  return find_any_of_sse2(p, e, a, b, c, d);
+}
+#endif
+
+inline find_any_of_t select_find_any_of() {
+#ifdef TP_XML_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return find_any_of_avx2;
+  return find_any_of_sse2;
+#else
+  return find_any_of_scalar;
+#endif
+}
+
+inline const char *find_any_of(const char *p, const char *e, char a, char b,
+                               char c, char d) {
+  static const find_any_of_t kernel = select_find_any_of();
+  return kernel(p, e, a, b, c, d);
+}
+
+} // namespace simd
+
+/**
+ * @brief finds the end of the fragment that starts at position p
  *
- * TODO: too big recurrence in regex parsing
+ * A fragment is either a text run (up to the next '<') or markup: a tag,
+ * <!-- comment -->, <![CDATA[ ... ]]>, <? processing instruction ?> or
+ * <!DECLARATION [ internal subset ] >. Quoted strings inside tags may contain
+ * '>' and '\\' escaped quotes.
+ *
+ * returns the position one past the fragment, or npos if the fragment does
+ * not end inside xmltxt
  */
-auto simple_parse_xml = [](const std::string xmltxt0, auto on_fragment) {
-  static const std::string regex_string = R"([<][!][-][-].*[-][-][>])";
-  static const std::regex r(regex_string);
-  std::string xmltxt = std::regex_replace(xmltxt0, r, "");
+inline std::size_t fragment_end(std::string_view xmltxt, std::size_t p) {
+  static constexpr auto npos = std::string_view::npos;
+  if (xmltxt[p] != '<')
+    return xmltxt.find('<', p);
+  auto closed_by = [&](std::size_t skip, std::string_view end) {
+    auto e = xmltxt.find(end, p + skip);
+    return (e == npos) ? npos : e + end.size();
+  };
+  std::string_view rest = xmltxt.substr(p);
+  if (rest.substr(0, 4) == "<!--")
+    return closed_by(4, "-->");
+  if (rest.substr(0, 9) == "<![CDATA[")
+    return closed_by(9, "]]>");
+  if (rest.substr(0, 2) == "<?")
+    return closed_by(2, "?>");
+  const bool declaration = (rest.size() > 1) && (rest[1] == '!');
+  const char *const b = xmltxt.data();
+  const char *const e = b + xmltxt.size();
+  const char *q = b + p + 1;
   char in_string = 0;
-  char escape = 0;
-  std::string fragment = "";
-  for (auto &c : xmltxt) {
-    if (c == '<') {
-      if (fragment.size() > 0)
-        on_fragment(fragment);
-      fragment = c;
-    } else if (fragment[0] == '<') {
-      if (in_string) {
-        if (escape == '\\') {
-          switch (c) {
-          case '\\':
-            fragment += c;
-            break;
-          case 'n':
-            fragment += '\n';
-            break;
-          case 'r':
-            fragment += '\r';
-            break;
-          case 't':
-            fragment += '\t';
-            break;
-          case 'b':
-            fragment += '\b';
-            break;
-          default:
-            fragment += c;
-          }
-          escape = 0;
-        } else {
-          if (c != '\\') {
-            fragment += c;
-            if (c == in_string)
-              in_string = 0;
-          } else
-            fragment += c;
-          escape = c;
-        }
-      } else if (c == '>') {
-        fragment += c;
-        if (fragment.size() > 0)
-          on_fragment(fragment);
-        fragment = "";
-      } else if ((c == '\"') || (c == '\'')) {
+  int brackets = 0;
+  while (q < e) {
+    if (in_string) {
+      // long attribute values are skipped here
+      q = simd::find_any_of(q, e, in_string, '\\', in_string, in_string);
+      if (q == e)
+        break;
+      if (*q == in_string)
+        in_string = 0;
+      q += (*q == '\\') ? 2 : 1;
+    } else if (declaration) {
+      const char c = *q++;
+      if ((c == '"') || (c == '\''))
         in_string = c;
-        fragment += c;
-      } else {
-        fragment += c;
-      }
+      else if (c == '[')
+        brackets++;
+      else if ((c == ']') && (brackets > 0))
+        brackets--;
+      else if ((c == '>') && (brackets == 0))
+        return q - b;
     } else {
-      fragment += c;
+      q = simd::find_any_of(q, e, '>', '"', '\'', '>');
+      if (q == e)
+        break;
+      if (*q == '>')
+        return q - b + 1;
+      in_string = *q++;
     }
   }
-  if (fragment.size() > 0)
-    on_fragment(fragment);
+  return npos;
+}
+
+/**
+ * @brief true if the fragment is an xml comment
+ */
+inline bool is_comment_fragment(std::string_view fragment) {
+  return fragment.substr(0, 4) == "<!--";
+}
+
+/**
+ * @brief splits xml text into fragments in one forward scan
+ *
+ * on_fragment receives std::string_view pointing into xmltxt, so nothing is
+ * copied. Comments are skipped. A fragment that is not closed before the end
+ * of the text is reported as it is.
+ */
+template <class F>
+inline void tokenize_xml(std::string_view xmltxt, F on_fragment) {
+  std::size_t p = 0;
+  while (p < xmltxt.size()) {
+    std::size_t e = fragment_end(xmltxt, p);
+    if (e == std::string_view::npos)
+      e = xmltxt.size();
+    std::string_view fragment = xmltxt.substr(p, e - p);
+    if (!is_comment_fragment(fragment))
+      on_fragment(fragment);
+    p = e;
+  }
+}
+
+/**
+ * @brief parses xml string into tree of strings - elements in < and >, and
+ * other parts
+ *
+ * kept for compatibility, on_fragment receives copies of the fragments. See
+ * tokenize_xml.
+ */
+auto simple_parse_xml = [](std::string_view xmltxt, auto on_fragment) {
+  tokenize_xml(xmltxt,
+               [&](std::string_view fragment) { on_fragment(std::string(fragment)); });
+};
+/**
+ * true for </name> fragments
+ */
+inline bool is_closing_tag(std::string_view s) {
+  return (s.size() > 2) && (s[0] == '<') && (s.back() == '>') && (s[1] == '/');
+}
+
+/**
+ * true if the fragment starts an element that has children (not self-closing,
+ * not a declaration or processing instruction)
+ */
+inline bool opens_element(std::string_view s) {
+  return (s.size() > 1) && (s[0] == '<') && (s.back() == '>') &&
+         (s[s.size() - 2] != '/') && (s[1] != '!') && (s[1] != '?');
+}
+
+/**
+ * name of the element from <name ...> or </name> fragment
+ */
+inline std::string_view element_name(std::string_view s) {
+  std::size_t a = (s.size() > 1 && s[1] == '/') ? 2 : 1;
+  std::size_t e = a;
+  while ((e < s.size()) && (s[e] != '>') && (s[e] != '/') && (s[e] != ' ') &&
+         (s[e] != '\t') && (s[e] != '\n') && (s[e] != '\r'))
+    e++;
+  return s.substr(a, e - a);
+}
+
+/**
+ * @brief stack of open elements used by the tree builders
+ *
+ * value is what the builder needs to append children (node pointer or
+ * index). Names are views into the parsed text. close and finish report
+ * broken structure as parse_error.
+ */
+template <class T> class element_stack_t {
+public:
+  struct entry_t {
+    T value;
+    std::string_view name;
+    std::size_t offset;
+  };
+  std::vector<entry_t> stack;
+
+  explicit element_stack_t(T root) {
+    stack.reserve(32);
+    stack.push_back({root, {}, 0});
+  }
+  T &top() { return stack.back().value; }
+  void open(T value, std::string_view fragment, std::size_t offset) {
+    stack.push_back({value, element_name(fragment), offset});
+  }
+  void close(std::string_view fragment, std::size_t offset) {
+    std::string_view name = element_name(fragment);
+    if (stack.size() < 2)
+      throw parse_error("unexpected closing tag </" + std::string(name) + ">",
+                        offset);
+    if (stack.back().name != name)
+      throw parse_error("closing tag </" + std::string(name) +
+                            "> does not match <" +
+                            std::string(stack.back().name) +
+                            "> (opened at byte " +
+                            std::to_string(stack.back().offset) + ")",
+                        offset);
+    stack.pop_back();
+  }
+  void finish() {
+    if (stack.size() > 1)
+      throw parse_error("element <" + std::string(stack.back().name) +
+                            "> is not closed",
+                        stack.back().offset);
+  }
 };
+
 /**
  * for given xml string generates the tree (it does not interpret xml)
+ *
+ * throws parse_error on mismatched or unclosed tags
  * */
-auto string_to_tree = [](auto xml_string) {
+auto string_to_tree = [](std::string_view xml_string) {
   tree_elem_t<std::string> elements;
-  std::map<tree_elem_t<std::string> *, tree_elem_t<std::string> *> parents = {
-      {&elements, &elements}};
-  tree_elem_t<std::string> *current_element = &elements;
-  simple_parse_xml(xml_string, [&elements, &current_element,
-                                &parents](std::string s) {
-    if (s.size()) {
-      //      std::cout << "EEE::" << s << std::endl;
-      if ((s.size() > 2) && (s[0] == '<') && (s.back() == '>') && (s[1] == '/'))
-        current_element = parents.at(current_element);
-      else {
-        current_element->children.push_back({s, {}});
-        parents[&(current_element->children.back())] = current_element;
-        if ((s[0] == '<') && (s.back() == '>') && (s[s.size() - 2] != '/') &&
-            (s[1] != '!'))
-          current_element = &(current_element->children.back());
-      }
+  element_stack_t<tree_elem_t<std::string> *> open(&elements);
+  tokenize_xml(xml_string, [&](std::string_view s) {
+    const std::size_t offset = s.data() - xml_string.data();
+    if (is_closing_tag(s)) {
+      open.close(s, offset);
+    } else {
+      auto &children = open.top()->children;
+      children.push_back({std::string(s), {}});
+      if (opens_element(s))
+        open.open(&children.back(), s, offset);
     }
   });
+  open.finish();
   return elements;
 };
 
-auto entities_convert = [](const std::string &str) -> std::string {
-  static auto xml_entities = []() -> std::map<std::string, std::string> {
-    return {
-        {"&nbsp;", " "},  {"&lt;", "<"},    {"&gt;", ">"},   {"&amp;", "&"},
-        {"&quot;", "\""}, {"&apos;", "'"},  {"&cent;", "¢"}, {"&pound;", "£"},
-        {"&yen;", "¥"},   {"&euro;", "€"},  {"&copy;", "©"}, {"&reg;", "®"},
-        {"&#160;", " "},  {"&#60;", "<"},   {"&#62;", ">"},  {"&#38;", "&"},
-        {"&#34;", "\""},  {"&#39;", "'"},   {"&#162;", "¢"}, {"&#163;", "£"},
-        {"&#165;", "¥"},  {"&#8364;", "€"}, {"&#169;", "©"}, {"&#174;", "®"}};
-  }();
-  std::stringstream ret;
-  std::string stringfrag;
-  for (auto e : str) {
-    if ((stringfrag.size() == 0) && (e != '&')) {
-      ret << e;
+/**
+ * @brief writes code point cp as UTF-8, returns the end of written bytes
+ */
+inline char *utf8_encode(std::uint32_t cp, char *dst) {
+  if (cp < 0x80) {
+    *dst++ = static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    *dst++ = static_cast<char>(0xC0 | (cp >> 6));
+    *dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    *dst++ = static_cast<char>(0xE0 | (cp >> 12));
+    *dst++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    *dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+  } else {
+    *dst++ = static_cast<char>(0xF0 | (cp >> 18));
+    *dst++ = static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+    *dst++ = static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+    *dst++ = static_cast<char>(0x80 | (cp & 0x3F));
+  }
+  return dst;
+}
+
+/**
+ * @brief code point of the named entity (without & and ;), 0 if unknown
+ */
+inline std::uint32_t named_entity(std::string_view n) {
+  switch (n.size()) {
+  case 2:
+    if (n == "lt")
+      return '<';
+    if (n == "gt")
+      return '>';
+    break;
+  case 3:
+    if (n == "amp")
+      return '&';
+    if (n == "yen")
+      return 0xA5;
+    if (n == "reg")
+      return 0xAE;
+    break;
+  case 4:
+    switch (n[0]) {
+    case 'q':
+      return (n == "quot") ? '"' : 0;
+    case 'a':
+      return (n == "apos") ? '\'' : 0;
+    case 'n':
+      return (n == "nbsp") ? 0xA0 : 0;
+    case 'c':
+      return (n == "cent") ? 0xA2 : (n == "copy") ? 0xA9 : 0;
+    case 'e':
+      return (n == "euro") ? 0x20AC : 0;
+    }
+    break;
+  case 5:
+    if (n == "pound")
+      return 0xA3;
+    break;
+  }
+  return 0;
+}
+
+/**
+ * @brief code point of &#NNN; or &#xHH; body (without &# and ;), 0 if it is
+ * not a valid character reference
+ */
+inline std::uint32_t numeric_entity(std::string_view n) {
+  std::uint32_t cp = 0;
+  const bool hex = !n.empty() && ((n[0] == 'x') || (n[0] == 'X'));
+  if (hex)
+    n.remove_prefix(1);
+  if (n.empty() || (n.size() > 8))
+    return 0;
+  for (char c : n) {
+    std::uint32_t digit;
+    if ((c >= '0') && (c <= '9'))
+      digit = c - '0';
+    else if (hex && (c >= 'a') && (c <= 'f'))
+      digit = c - 'a' + 10;
+    else if (hex && (c >= 'A') && (c <= 'F'))
+      digit = c - 'A' + 10;
+    else
+      return 0;
+    cp = cp * (hex ? 16 : 10) + digit;
+  }
+  if ((cp > 0x10FFFF) || ((cp >= 0xD800) && (cp <= 0xDFFF)))
+    return 0;
+  return cp;
+}
+
+/**
+ * longest entity decode_entities looks for, from '&' to ';'
+ */
+inline constexpr std::size_t max_entity_size = 12;
+
+/**
+ * @brief decodes xml entities from in into out without allocating
+ *
+ * out needs room for in.size() characters (decoded text is never longer)
+ * and may be in.data() itself for decoding in place. Runs without '&' are
+ * found with memchr and moved in one piece. Unknown entities are copied as
+ * they are. Returns the end of the written data.
+ */
+inline char *decode_entities(std::string_view in, char *out) {
+  const char *p = in.data();
+  const char *const e = p + in.size();
+  while (p < e) {
+    auto amp = static_cast<const char *>(std::memchr(p, '&', e - p));
+    const char *run_end = amp ? amp : e;
+    if (out != p)
+      std::memmove(out, p, run_end - p);
+    out += run_end - p;
+    p = run_end;
+    if (!amp)
+      break;
+    // entities are short, do not look for ';' further than that
+    const std::size_t limit = std::min<std::size_t>(e - amp, max_entity_size);
+    auto semi = static_cast<const char *>(std::memchr(amp, ';', limit));
+    std::uint32_t cp = 0;
+    if (semi) {
+      std::string_view body(amp + 1, semi - amp - 1);
+      cp = (!body.empty() && (body[0] == '#')) ? numeric_entity(body.substr(1))
+                                                : named_entity(body);
+    }
+    if (cp) {
+      out = utf8_encode(cp, out);
+      p = semi + 1;
     } else {
-      stringfrag += e;
-      if (stringfrag[0] == '&') {
-        if (e == ';') {
-          ret << xml_entities[stringfrag];
-          stringfrag = "";
-        }
-      }
+      *out++ = '&';
+      p = amp + 1;
     }
   }
-  return ret.str();
+  return out;
+}
+
+/**
+ * @brief decodes xml entities of s in place
+ */
+template <class S> inline void decode_entities_in_place(S &s) {
+  if (s.find('&') != S::npos)
+    s.resize(decode_entities(s, s.data()) - s.data());
+}
+
+auto entities_convert = [](const std::string &str) -> std::string {
+  std::string ret(str);
+  decode_entities_in_place(ret);
+  return ret;
 };
 
-auto str_to_element = [](const std::string &txt) -> element_t {
-  element_t ret;
-  if ((txt.front() == '<') && (txt.back() == '>')) {
-    if ((txt[1] == '!') || (txt[1] == '?')) {
-      tag_t ret_tag;
-      ret_tag.tag = txt;
-      ret = ret_tag;
-    } else {
+/**
+ * @brief character represented by backslash escape sequence \\c in quoted
+ * attribute value
+ */
+inline char escaped_char(char c) {
+  switch (c) {
+  case 'n':
+    return '\n';
+  case 'r':
+    return '\r';
+  case 't':
+    return '\t';
+  case 'b':
+    return '\b';
+  default:
+    return c;
+  }
+}
 
-      std::string name;
-      std::string value;
-      std::size_t p = 1;
-      // go to next important fragment (skip spaces)
-      auto skip_white_space = [&]() {
-        while ((p < txt.size()) && ((txt[p] == ' ') || (txt[p] == '\t') ||
-                                    (txt[p] == '\n') || (txt[p] == '\r')))
-          p++;
-      };
-      // extract string into name
-      auto _name = [&]() {
-        skip_white_space();
-        int a = p;
-        while ((p < txt.size()) &&
-               (((txt[p] >= '-') && (txt[p] <= ':')) || ((txt[p] == '!')) ||
-                ((txt[p] >= '@') && (txt[p] <= 'z'))))
-          p++;
-        name = txt.substr(a, p - a);
-      };
-      // extract string into value. Interpret equal sign properly
-      auto _value = [&]() {
-        value = "";
-        while ((p < txt.size()) && (txt[p] != '='))
-          p++;
-        skip_white_space();
-        if (p >= txt.size()) {
-          return;
-        }
-        p++;
-        int a = p;
-        // std::cout << "p " << p << " = " << txt[p] << std::endl;
-        if ((p >= txt.size()) || ((txt[p] != '"') && (txt[p - 1] != '\''))) {
-          value = "";
-          return;
-        }
-        p++;
-        value = "";
-        while ((p < txt.size()) && (txt[p] != txt[a])) {
-          value = value + ((txt[p] == '\\') ? txt[p + 1] : txt[p]);
-          p = p + ((txt[p] == '\\') ? 2 : 1);
-        }
-        // std::cout << "VALUE (" << a << "-" << p << "): " << value <<
-        // std::endl;
-      };
+/**
+ * characters allowed in tag and attribute names
+ */
+inline bool is_name_char(char c) {
+  return ((c >= '-') && (c <= ':') && (c != '/')) || (c == '!') ||
+         ((c >= '@') && (c <= 'z'));
+}
+
+inline bool is_white_space(char c) {
+  return (c == ' ') || (c == '\t') || (c == '\n') || (c == '\r');
+}
+
+/**
+ * name of the tag from <name ...> fragment, as scan_tag returns it
+ */
+inline std::string_view scan_tag_name(std::string_view txt) {
+  std::size_t p = 1;
+  while ((p < txt.size()) && is_white_space(txt[p]))
+    p++;
+  std::size_t a = p;
+  while ((p < txt.size()) && is_name_char(txt[p]))
+    p++;
+  return txt.substr(a, p - a);
+}
+
+/**
+ * @brief splits tag fragment into name and attributes without copying
+ *
+ * on_attr(name, raw_value) receives views into the fragment. raw_value is the
+ * text between the quotes, backslash escapes are not decoded (see
+ * unescape_value). The '/' of self-closing tags is not a part of any name.
+ * Returns the tag name.
+ */
+template <class F>
+inline std::string_view scan_tag(std::string_view txt, F on_attr) {
+  std::size_t p = 1;
+  auto skip_white_space = [&]() {
+    while ((p < txt.size()) && is_white_space(txt[p]))
+      p++;
+  };
+  auto name = [&]() {
+    skip_white_space();
+    std::size_t a = p;
+    while ((p < txt.size()) && is_name_char(txt[p]))
+      p++;
+    return txt.substr(a, p - a);
+  };
+  std::string_view tag_name = scan_tag_name(txt);
+  p = tag_name.data() + tag_name.size() - txt.data();
+  while (p < txt.size()) {
+    std::string_view attr_name = name();
+    if (attr_name.empty()) {
+      p++;
+      continue;
+    }
+    skip_white_space();
+    std::string_view value;
+    if ((p < txt.size()) && (txt[p] == '=')) {
+      p++;
       skip_white_space();
-      _name();
-      tag_t ret_tag;
-      ret_tag.tag = name;
-      while (p < txt.size()) {
-        _name();
-        _value();
-        if (name.size() > 0) {
-          ret_tag.attr[name] = value;
+      if ((p < txt.size()) && ((txt[p] == '"') || (txt[p] == '\''))) {
+        const char quote = txt[p++];
+        std::size_t a = p;
+        const char *const e = txt.data() + txt.size();
+        while (p < txt.size()) {
+          p = simd::find_any_of(txt.data() + p, e, quote, '\\', quote, quote) -
+              txt.data();
+          if ((p >= txt.size()) || (txt[p] == quote))
+            break;
+          p += 2;
         }
+        value = txt.substr(a, std::min(p, txt.size()) - a);
         p++;
       }
-      ret = ret_tag;
     }
-  } else {
-    ret = txt;
+    on_attr(attr_name, value);
   }
-  return ret;
-};
+  return tag_name;
+}
 
-} // namespace helpers
+/**
+ * @brief decodes backslash escapes of raw attribute value into dst, which
+ * must have room for raw.size() characters (it may be raw.data() itself).
+ * Runs between backslashes are moved in one piece. Returns the end of the
+ * written data.
+ */
+inline char *unescape_value(std::string_view raw, char *dst) {
+  const char *p = raw.data();
+  const char *const e = p + raw.size();
+  while (p < e) {
+    auto bs = static_cast<const char *>(std::memchr(p, '\\', e - p));
+    const char *run_end = bs ? bs : e;
+    if (dst != p)
+      std::memmove(dst, p, run_end - p);
+    dst += run_end - p;
+    if (!bs)
+      break;
+    if (bs + 1 < e)
+      *dst++ = escaped_char(bs[1]);
+    p = bs + 2;
+  }
+  return dst;
+}
+
+/**
+ * @brief builds flat_document_t from xml text in one pass over the fragments
+ *
+ * the structure is the same as the one made by string_to_tree. Throws
+ * parse_error on mismatched or unclosed tags.
+ */
+inline flat_document_t build_flat_document(std::string_view xml_text,
+                                           bool with_entities) {
+  flat_document_t doc;
+  doc.nodes.push_back({});
+  // open elements: node index and index of its last child
+  element_stack_t<std::pair<std::uint32_t, std::uint32_t>> open(
+      {0, flat_node_t::npos});
+  auto store_text = [&](std::string_view s) -> std::string_view {
+    if (!with_entities || (s.find('&') == std::string_view::npos))
+      return doc.arena.store(s);
+    char *dst = doc.arena.allocate(s.size());
+    return {dst, std::size_t(decode_entities(s, dst) - dst)};
+  };
+  auto store_value = [&](std::string_view raw) -> std::string_view {
+    if (raw.empty())
+      return {};
+    char *dst = doc.arena.allocate(raw.size());
+    char *end = unescape_value(raw, dst);
+    if (with_entities)
+      end = decode_entities({dst, std::size_t(end - dst)}, dst);
+    return {dst, std::size_t(end - dst)};
+  };
+  tokenize_xml(xml_text, [&](std::string_view s) {
+    const std::size_t offset = s.data() - xml_text.data();
+    if (is_closing_tag(s)) {
+      open.close(s, offset);
+      return;
+    }
+    const auto n = static_cast<std::uint32_t>(doc.nodes.size());
+    flat_node_t node;
+    if (s.substr(0, 9) == "<![CDATA[") {
+      node.value = doc.arena.store(s.substr(9, s.size() - 12));
+    } else if ((s.size() > 1) && (s.front() == '<') && (s.back() == '>')) {
+      node.is_tag = true;
+      node.attr_begin = static_cast<std::uint32_t>(doc.attrs.size());
+      if ((s[1] == '!') || (s[1] == '?')) {
+        node.value = doc.arena.store(s);
+      } else {
+        node.value = doc.arena.store(
+            scan_tag(s, [&](std::string_view name, std::string_view value) {
+              doc.attrs.push_back({doc.arena.store(name), store_value(value)});
+            }));
+      }
+      node.attr_count =
+          static_cast<std::uint32_t>(doc.attrs.size()) - node.attr_begin;
+    } else {
+      node.value = store_text(s);
+    }
+    doc.nodes.push_back(node);
+    auto &[parent, last] = open.top();
+    if (last == flat_node_t::npos)
+      doc.nodes[parent].first_child = n;
+    else
+      doc.nodes[last].next_sibling = n;
+    last = n;
+    if (opens_element(s))
+      open.open({n, flat_node_t::npos}, s, offset);
+  });
+  open.finish();
+  return doc;
+}
 
-inline tree_elem_t<element_t> text_to_xml(const std::string &xml_text) {
-  auto elements = helpers::string_to_tree(xml_text);
-  return transform_tree<std::string, element_t>(
-      elements, [](auto &a, auto d) { return helpers::str_to_element(a); });
+/**
+ * @brief decodes raw attribute value (backslash escapes and, optionally,
+ * entities) with one copy into a string of type S made with alloc
+ */
+template <class S = std::string>
+inline S decode_value(std::string_view raw, bool with_entities,
+                      const typename S::allocator_type &alloc = {}) {
+  S v(raw, alloc);
+  if (raw.find('\\') != std::string_view::npos)
+    v.resize(unescape_value(v, v.data()) - v.data());
+  if (with_entities)
+    decode_entities_in_place(v);
+  return v;
+}
+
+/**
+ * @brief converts one fragment from tokenize_xml into element_t (or
+ * pmr::element_t, whose strings are made with alloc), parsing the attributes
+ * and decoding entities on the way
+ *
+ * CDATA sections become text as they are
+ */
+template <class E = element_t, class S = std::variant_alternative_t<0, E>>
+inline E fragment_to_element(std::string_view s, bool with_entities,
+                             const typename S::allocator_type &alloc = {}) {
+  using tag_type = std::variant_alternative_t<1, E>;
+  if ((s.size() > 1) && (s.front() == '<') && (s.back() == '>')) {
+    if (s.substr(0, 9) == "<![CDATA[")
+      return S(s.substr(9, s.size() - 12), alloc);
+    tag_type ret_tag{decltype(tag_type::attr)(alloc), {}};
+    if ((s[1] == '!') || (s[1] == '?')) {
+      ret_tag.tag = name_t::markup();
+      ret_tag.attr[name_t::markup()] = S(s, alloc);
+    } else {
+      ret_tag.tag = name_t(
+          scan_tag(s, [&](std::string_view name, std::string_view value) {
+            ret_tag.attr[name_t(name)] =
+                decode_value<S>(value, with_entities, alloc);
+          }));
+    }
+    return ret_tag;
+  }
+  S text(s, alloc);
+  if (with_entities)
+    decode_entities_in_place(text);
+  return text;
+}
+
+/**
+ * @brief builds a tree in one pass: tokenizes, converts every fragment with
+ * to_element(std::string_view) -> E and links the nodes
+ *
+ * on_node(tree_elem_t<E, A> &) is called for every new node, for example to
+ * build indexes while parsing. Node addresses stay valid when the returned
+ * tree is moved. Children lists are made with alloc.
+ *
+ * throws parse_error on mismatched or unclosed tags
+ */
+template <class E, class C, class F, class A = std::allocator<E>>
+inline tree_elem_t<E, A> build_tree_of(std::string_view xml_text,
+                                       C to_element, F on_node,
+                                       const A &alloc = A()) {
+  using node_t = tree_elem_t<E, A>;
+  using children_t = decltype(node_t::children);
+  node_t root{E(), children_t(alloc)};
+  element_stack_t<node_t *> open(&root);
+  tokenize_xml(xml_text, [&](std::string_view s) {
+    const std::size_t offset = s.data() - xml_text.data();
+    if (is_closing_tag(s)) {
+      open.close(s, offset);
+    } else {
+      auto &children = open.top()->children;
+      children.push_back({to_element(s), children_t(alloc)});
+      on_node(children.back());
+      if (opens_element(s))
+        open.open(&children.back(), s, offset);
+    }
+  });
+  open.finish();
+  return root;
 }
 
+/**
+ * @brief builds tree_elem_t<element_t>, parsing attributes and decoding
+ * entities on the way. See build_tree_of for on_node.
+ */
+template <class F>
 inline tree_elem_t<element_t>
-text_to_xml_with_entities(const std::string &xml_text) {
-  auto elements = text_to_xml(xml_text);
-  return transform_tree<element_t, element_t>(
-      elements, [](const auto &a, int d) {
-        element_t r = a;
-        switch (r.index()) {
-        case 0:
-          r = helpers::entities_convert(std::get<0>(r));
-          break;
-        case 1:
-          for (auto &[k, v] : std::get<1>(r).attr) {
-            v = helpers::entities_convert(v);
-          }
-          break;
+build_tree(std::string_view xml_text, bool with_entities, F on_node) {
+  return build_tree_of<element_t>(
+      xml_text,
+      [with_entities](std::string_view s) {
+        return fragment_to_element(s, with_entities);
+      },
+      on_node);
+}
+
+inline tree_elem_t<element_t> build_tree(std::string_view xml_text,
+                                         bool with_entities) {
+  return build_tree(xml_text, with_entities, [](tree_elem_t<element_t> &) {});
+}
+
+/**
+ * @brief builds pmr::tree_t with every node, string and attribute list in
+ * resource
+ */
+inline pmr::tree_t build_pmr_tree(std::string_view xml_text,
+                                  bool with_entities,
+                                  std::pmr::memory_resource *resource) {
+  const std::pmr::polymorphic_allocator<pmr::element_t> alloc(resource);
+  return build_tree_of<pmr::element_t>(
+      xml_text,
+      [with_entities, resource](std::string_view s) {
+        return fragment_to_element<pmr::element_t>(s, with_entities, resource);
+      },
+      [](pmr::tree_t &) {}, alloc);
+}
+
+/**
+ * @brief converts one fragment (tag or text) into element_t
+ *
+ * tags are split with scan_tag, every value is copied once
+ */
+auto str_to_element = [](std::string_view txt) -> element_t {
+  return fragment_to_element(txt, false);
+};
+
+/**
+ * walks documents that keep nodes in an array linked by first_child and
+ * next_sibling indices (flat_document_t). E is the view given to the
+ * callbacks, made as E{&doc, node}.
+ */
+template <class E = flat_element_t, class D, class F>
+inline void walk_flat(const D &doc, std::uint32_t n, F &f, int d) {
+  E e{&doc, n};
+  if (walk_callback(f, e, d) != WALK_CONTINUE)
+    return;
+  // next node to visit on every level
+  std::vector<std::uint32_t> stack;
+  stack.reserve(32);
+  stack.push_back(doc.nodes[n].first_child);
+  while (!stack.empty()) {
+    const std::uint32_t c = stack.back();
+    if (c == ~std::uint32_t(0)) {
+      stack.pop_back();
+      continue;
+    }
+    stack.back() = doc.nodes[c].next_sibling;
+    e.node = c;
+    auto r = walk_callback(f, e, d + int(stack.size()));
+    if (r == WALK_STOP)
+      return;
+    if (r == WALK_CONTINUE)
+      stack.push_back(doc.nodes[c].first_child);
+  }
+}
+
+template <class E = flat_element_t, class D, class F_PRE, class F_POST>
+inline void walk_flat_io(const D &doc, std::uint32_t n, F_PRE &f_pre,
+                         F_POST &f_post, int d) {
+  // node and next child to visit on every level
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> stack;
+  stack.reserve(32);
+  auto pre = [&](std::uint32_t node, int depth) {
+    E e{&doc, node};
+    auto r = walk_callback(f_pre, e, depth);
+    if (r == WALK_CONTINUE)
+      stack.push_back({node, doc.nodes[node].first_child});
+    else if (r == WALK_SKIP_CHILDREN)
+      r = walk_callback(f_post, e, depth);
+    return r != WALK_STOP;
+  };
+  if (!pre(n, d))
+    return;
+  while (!stack.empty()) {
+    auto &[node, c] = stack.back();
+    if (c == ~std::uint32_t(0)) {
+      E e{&doc, node};
+      stack.pop_back();
+      if (walk_callback(f_post, e, d + int(stack.size())) == WALK_STOP)
+        return;
+      continue;
+    }
+    const std::uint32_t child = c;
+    c = doc.nodes[child].next_sibling;
+    if (!pre(child, d + int(stack.size())))
+      return;
+  }
+}
+
+} // namespace helpers
+
+/**
+ * text node of the lazy tree. Keeps the raw text and decodes entities on the
+ * first call to str(). The raw text is a view into the parsed document,
+ * which must outlive the tree.
+ * */
+class lazy_text_t {
+public:
+  lazy_text_t() = default;
+  lazy_text_t(std::string_view raw, bool with_entities)
+      : raw_text(raw), state(with_entities ? UNKNOWN : RAW) {}
+
+  std::string_view raw() const { return raw_text; }
+  /**
+   * decoded text. The view is valid as long as this object is not moved or
+   * destroyed.
+   */
+  std::string_view str() const {
+    if (state == UNKNOWN) {
+      if (raw_text.find('&') == std::string_view::npos) {
+        state = RAW;
+      } else {
+        decoded.assign(raw_text);
+        helpers::decode_entities_in_place(decoded);
+        state = DECODED;
+      }
+    }
+    return (state == RAW) ? raw_text : std::string_view(decoded);
+  }
+
+private:
+  enum state_e : std::uint8_t { UNKNOWN, RAW, DECODED };
+  std::string_view raw_text;
+  mutable state_e state = RAW;
+  mutable std::string decoded;
+};
+
+/**
+ * tag of the lazy tree. Only the name is parsed up front. Attributes are
+ * split out of the raw tag on the first lookup, and every value is decoded
+ * when it is read for the first time. Results are cached, so a lazy tree
+ * must not be read from many threads at once.
+ * */
+class lazy_tag_t {
+public:
+  name_t tag;
+
+  lazy_tag_t() = default;
+  lazy_tag_t(std::string_view raw, bool with_entities)
+      : raw_tag(raw), with_entities(with_entities) {
+    if ((raw.size() > 1) && ((raw[1] == '!') || (raw[1] == '?')))
+      tag = name_t::markup();
+    else
+      tag = name_t(helpers::scan_tag_name(raw));
+  }
+
+  std::string_view raw() const { return raw_tag; }
+  bool is_markup() const { return tag == name_t::markup(); }
+  /**
+   * text of <!...> or <?...?> markup, empty for elements
+   */
+  std::string_view markup() const {
+    return is_markup() ? raw_tag : std::string_view();
+  }
+
+  bool has_attr(name_t name) const { return find(name) != nullptr; }
+  /**
+   * value of the attribute, or empty view if there is no such attribute.
+   * The view is valid as long as this object is not moved or destroyed.
+   */
+  std::string_view attr(name_t name) const {
+    lazy_attr_t *a = find(name);
+    return a ? value(*a) : std::string_view();
+  }
+  /**
+   * calls f(name_t, std::string_view value) for every attribute in document
+   * order
+   */
+  template <class F> void for_each_attr(F f) const {
+    scan();
+    for (auto &a : attrs)
+      f(a.name, value(a));
+  }
+  /**
+   * decodes everything into the eager representation
+   */
+  tag_t to_tag() const {
+    tag_t ret;
+    ret.tag = tag;
+    if (is_markup())
+      ret.attr[tag] = std::string(raw_tag);
+    for_each_attr([&](name_t name, std::string_view v) {
+      ret.attr[name] = std::string(v);
+    });
+    return ret;
+  }
+
+private:
+  struct lazy_attr_t {
+    name_t name;
+    std::string_view raw;
+    bool decoded = false;
+    std::string value;
+  };
+  std::string_view raw_tag;
+  bool with_entities = false;
+  mutable bool scanned = false;
+  mutable small_vector_t<lazy_attr_t, 4> attrs;
+
+  void scan() const {
+    if (scanned)
+      return;
+    scanned = true;
+    if (is_markup())
+      return;
+    helpers::scan_tag(raw_tag, [&](std::string_view name, std::string_view v) {
+      // the last of repeated attributes wins, like in tag_t
+      const name_t atom(name);
+      for (auto &a : attrs)
+        if (a.name == atom) {
+          a.raw = v;
+          return;
         }
-        return r;
-      });
+      attrs.push_back({atom, v, false, {}});
+    });
+  }
+  lazy_attr_t *find(name_t name) const {
+    scan();
+    for (auto &a : attrs)
+      if (a.name == name)
+        return &a;
+    return nullptr;
+  }
+  std::string_view value(lazy_attr_t &a) const {
+    if ((a.raw.find('\\') == std::string_view::npos) &&
+        (!with_entities || (a.raw.find('&') == std::string_view::npos)))
+      return a.raw;
+    if (!a.decoded) {
+      a.value = helpers::decode_value(a.raw, with_entities);
+      a.decoded = true;
+    }
+    return a.value;
+  }
+};
+
+/**
+ * element of the lazy tree, see text_to_xml. index() is 0 for text and 1 for
+ * tags, like in element_t.
+ * */
+using lazy_element_t = std::variant<lazy_text_t, lazy_tag_t>;
+
+template <class O>
+inline if_output_t<O> operator<<(O &o, const lazy_element_t &e) {
+  if (e.index() == 0) {
+    o << std::get<0>(e).str();
+  } else if (std::get<1>(e).is_markup()) {
+    o << "<\033[34m" << std::get<1>(e).markup() << "\033[0m>";
+  } else {
+    o << "<\033[34m" << std::get<1>(e).tag << "\033[0m";
+    std::get<1>(e).for_each_attr([&](name_t k, std::string_view v) {
+      o << " \033[31m" << k << "\033[0m=\033[32m" << v << "\033[0m";
+    });
+    o << ">";
+  }
+  return o;
+}
+
+namespace helpers {
+
+/**
+ * @brief converts one fragment from tokenize_xml into lazy_element_t. Only
+ * the tag name is parsed here.
+ */
+inline lazy_element_t fragment_to_lazy_element(std::string_view s,
+                                               bool with_entities) {
+  if ((s.size() > 1) && (s.front() == '<') && (s.back() == '>')) {
+    if (s.substr(0, 9) == "<![CDATA[")
+      return lazy_text_t(s.substr(9, s.size() - 12), false);
+    return lazy_tag_t(s, with_entities);
+  }
+  return lazy_text_t(s, with_entities);
+}
+
+inline tree_elem_t<lazy_element_t> build_lazy_tree(std::string_view xml_text,
+                                                   bool with_entities) {
+  return build_tree_of<lazy_element_t>(
+      xml_text,
+      [with_entities](std::string_view s) {
+        return fragment_to_lazy_element(s, with_entities);
+      },
+      [](tree_elem_t<lazy_element_t> &) {});
+}
+
+} // namespace helpers
+
+/**
+ * walk_tree and walk_tree_io for flat_document_t. Callbacks receive
+ * flat_element_t instead of element_t.
+ * */
+template <class F>
+inline void walk_tree(const flat_document_t &doc, F f, int d = 0) {
+  helpers::walk_flat(doc, 0, f, d);
+}
+template <class F> inline void walk_tree(flat_document_t &doc, F f, int d = 0) {
+  helpers::walk_flat(doc, 0, f, d);
+}
+template <class F_PRE, class F_POST>
+inline void walk_tree_io(const flat_document_t &doc, F_PRE f_pre,
+                         F_POST f_post, int d = 0) {
+  helpers::walk_flat_io(doc, 0, f_pre, f_post, d);
+}
+template <class F_PRE, class F_POST>
+inline void walk_tree_io(flat_document_t &doc, F_PRE f_pre, F_POST f_post,
+                         int d = 0) {
+  helpers::walk_flat_io(doc, 0, f_pre, f_post, d);
+}
+
+/**
+ * walk_tree that calls f(const tag_t &, depth) (const lazy_tag_t & for the
+ * lazy tree) only for tags with the given name. f may return walk_e like in walk_tree.
+ * Trees compare interned atoms; flat_document_t keeps tag names as views into
+ * the source, so its overload compares strings against name.str().
+ * */
+template <class T, class F> inline void walk_tags(T &t, name_t name, F f) {
+  walk_tree(t, [&](const auto &e, int d) {
+    if ((e.index() == 1) && (std::get<1>(e).tag == name))
+      return walk_callback(f, std::get<1>(e), d);
+    return WALK_CONTINUE;
+  });
+}
+
+template <class F>
+inline void walk_tags(const flat_document_t &doc, name_t name, F f) {
+  const std::string_view tag = name.str();
+  walk_tree(doc, [&](const flat_element_t &e, int d) {
+    if ((e.index() == 1) && (e.tag() == tag))
+      return walk_callback(f, e, d);
+    return WALK_CONTINUE;
+  });
 }
+template <class F> inline void walk_tags(flat_document_t &doc, name_t name, F f) {
+  walk_tags(static_cast<const flat_document_t &>(doc), name, f);
+}
+
+/**
+ * parses xml text. R selects the result: tree_elem_t<element_t>,
+ * flat_document_t or tree_elem_t<lazy_element_t>. The lazy tree refers to
+ * xml_text, which must outlive it.
+ * */
+template <class R = tree_elem_t<element_t>>
+inline R text_to_xml(std::string_view xml_text) {
+  if constexpr (std::is_same_v<R, flat_document_t>) {
+    return helpers::build_flat_document(xml_text, false);
+  } else if constexpr (std::is_same_v<R, tree_elem_t<lazy_element_t>>) {
+    return helpers::build_lazy_tree(xml_text, false);
+  } else if constexpr (std::is_same_v<R, pmr::tree_t>) {
+    return helpers::build_pmr_tree(xml_text, false,
+                                   std::pmr::get_default_resource());
+  } else {
+    return helpers::build_tree(xml_text, false);
+  }
+}
+
+template <class R = tree_elem_t<element_t>>
+inline R text_to_xml_with_entities(std::string_view xml_text) {
+  if constexpr (std::is_same_v<R, flat_document_t>) {
+    return helpers::build_flat_document(xml_text, true);
+  } else if constexpr (std::is_same_v<R, tree_elem_t<lazy_element_t>>) {
+    return helpers::build_lazy_tree(xml_text, true);
+  } else if constexpr (std::is_same_v<R, pmr::tree_t>) {
+    return helpers::build_pmr_tree(xml_text, true,
+                                   std::pmr::get_default_resource());
+  } else {
+    return helpers::build_tree(xml_text, true);
+  }
+}
+
+/**
+ * parses xml text into a tree that takes all its memory from resource
+ * */
+inline pmr::tree_t text_to_xml(std::string_view xml_text,
+                               std::pmr::memory_resource *resource) {
+  return helpers::build_pmr_tree(xml_text, false, resource);
+}
+inline pmr::tree_t
+text_to_xml_with_entities(std::string_view xml_text,
+                          std::pmr::memory_resource *resource) {
+  return helpers::build_pmr_tree(xml_text, true, resource);
+}
+
+namespace pmr {
+
+/**
+ * @brief parsed document that lives in one monotonic_buffer_resource
+ *
+ * the tree is never destroyed node by node: the destructor hands back the
+ * blocks of the resource at once, which for big documents is much faster
+ * than freeing millions of nodes and strings. Changes to the tree take
+ * memory from the same resource and are freed with it.
+ */
+class document_t {
+public:
+  explicit document_t(std::string_view xml_text, bool with_entities = true)
+      : arena(std::max<std::size_t>(xml_text.size(), 4096)) {
+    std::pmr::polymorphic_allocator<tree_t> alloc(&arena);
+    root = alloc.allocate(1);
+    new (root) tree_t(helpers::build_pmr_tree(xml_text, with_entities, &arena));
+  }
+  document_t(const document_t &) = delete;
+  document_t &operator=(const document_t &) = delete;
+
+  tree_t &tree() { return *root; }
+  const tree_t &tree() const { return *root; }
+
+private:
+  std::pmr::monotonic_buffer_resource arena;
+  tree_t *root;
+};
+
+} // namespace pmr
 
 } // namespace xml
 } // namespace tp
+
+#endif
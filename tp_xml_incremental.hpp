@@ -0,0 +1,322 @@
+
+/*
+TYPES:
+
+class incremental_tree_t {
+public:
+  explicit incremental_tree_t(std::string_view xml_text,
+                              bool with_entities = true);
+  const tree_elem_t<element_t> &tree() const;
+  std::size_t update(std::string_view xml_text, std::size_t begin,
+                     std::size_t old_length, std::size_t new_length);
+};
+
+Keeps the tree of a document that is edited in place. After bytes
+[begin, begin + old_length) of the text were replaced by new_length bytes,
+update() re-tokenizes only the smallest run of sibling nodes around the
+edit and splices the new nodes into the tree. An edit inside one opening
+tag (an attribute value, for example) replaces just the value of that
+element and keeps its children. Nodes outside the re-parsed part keep their
+addresses. The tree is always the same as text_to_xml (or
+text_to_xml_with_entities) of the current text would give.
+
+Every node has a span (offset relative to the content of its parent,
+length, length of the opening and closing tag), so an edit shifts only the
+spans of the later siblings of the nodes on the path to the edit.
+
+*/
+
+#ifndef __TP_XML_INCREMENTAL_HPP__
+#define __TP_XML_INCREMENTAL_HPP__
+
+#include <tp_tree_xml.hpp>
+
+namespace tp {
+namespace xml {
+
+/**
+ * position of one node in the text. offset is relative to the content of
+ * the parent (the byte after its opening tag).
+ * */
+struct node_span_t {
+  std::size_t offset = 0;
+  std::size_t length = 0;
+  std::size_t open_length = 0; // opening tag, 0 for text
+  std::size_t close_length = 0; // closing tag, 0 if there is none
+};
+
+class incremental_tree_t {
+public:
+  using node_t = tree_elem_t<element_t>;
+  using span_node_t = tree_elem_t<node_span_t>;
+
+  explicit incremental_tree_t(std::string_view xml_text,
+                              bool with_entities = true)
+      : with_entities(with_entities) {
+    rebuild(xml_text);
+  }
+
+  const node_t &tree() const { return root; }
+
+  /**
+   * @brief brings the tree up to date after an edit of the text
+   *
+   * xml_text is the whole text after the edit. Throws parse_error, as
+   * text_to_xml does, if the new text is broken; the tree stays as it was
+   * then. Returns the number of bytes that were parsed again.
+   */
+  std::size_t update(std::string_view xml_text, std::size_t begin,
+                     std::size_t old_length, std::size_t new_length) {
+    const std::ptrdiff_t delta =
+        std::ptrdiff_t(new_length) - std::ptrdiff_t(old_length);
+    const std::size_t end = begin + old_length; // in the old text
+    if ((end > root_span.value.length) ||
+        (xml_text.size() != std::size_t(root_span.value.length + delta)))
+      throw std::out_of_range("incremental_tree_t: edit outside of the text");
+
+    // path from the root to the deepest element whose content holds the edit
+    std::vector<frame_t> path = {{&root, &root_span, {}, 0}};
+    for (;;) {
+      frame_t &f = path.back();
+      const std::size_t content = f.start + f.span->value.open_length;
+      auto c = f.node->children.begin();
+      auto s = f.span->children.begin();
+      frame_t next{nullptr, nullptr, {}, 0};
+      for (; c != f.node->children.end(); ++c, ++s) {
+        const node_span_t &sp = s->value;
+        const std::size_t start = content + sp.offset;
+        if (start >= end)
+          break;
+        if (start + sp.length <= begin)
+          continue;
+        if (sp.close_length && (begin >= start + sp.open_length) &&
+            (end <= start + sp.length - sp.close_length)) {
+          next = {&*c, &*s, s, start};
+        } else if (sp.open_length && (begin > start) &&
+                   (end < start + sp.open_length)) {
+          if (update_open_tag(xml_text, path, {&*c, &*s, s, start}, begin,
+                              delta))
+            return sp.open_length;
+        }
+        break;
+      }
+      if (!next.node)
+        break;
+      path.push_back(next);
+    }
+    // splice at the deepest level that gives a balanced run of nodes
+    for (std::size_t level = path.size(); level-- > 0;) {
+      std::size_t parsed = 0;
+      if (splice(xml_text, path, level, begin, end, delta, parsed))
+        return parsed;
+    }
+    rebuild(xml_text);
+    return xml_text.size();
+  }
+
+private:
+  struct frame_t {
+    node_t *node;
+    span_node_t *span;
+    std::list<span_node_t>::iterator span_it; // in the parent list
+    std::size_t start;                         // in the old text
+  };
+
+  bool with_entities;
+  node_t root;
+  span_node_t root_span;
+
+  void rebuild(std::string_view xml_text) {
+    node_t new_root;
+    span_node_t new_span;
+    new_span.value.length = xml_text.size();
+    parse_range(xml_text, 0, xml_text.size(), false, new_root.children,
+                new_span.children);
+    root = std::move(new_root);
+    root_span = std::move(new_span);
+  }
+
+  /**
+   * @brief parses text [a, b) into nodes appended to nodes and spans, with
+   * offsets relative to a
+   *
+   * strict: a fragment that does not end inside the range gives false
+   * instead of being taken as it is. Structure errors throw parse_error.
+   */
+  bool parse_range(std::string_view xml_text, std::size_t a, std::size_t b,
+                   bool strict, std::list<node_t> &nodes,
+                   std::list<span_node_t> &spans) const {
+    struct open_t {
+      std::list<node_t> *nodes;
+      std::list<span_node_t> *spans;
+      std::size_t content; // where offsets of children count from
+    };
+    helpers::element_stack_t<open_t> open({&nodes, &spans, a});
+    std::string_view range = xml_text.substr(0, b);
+    std::size_t p = a;
+    while (p < b) {
+      std::size_t e = helpers::fragment_end(range, p);
+      bool terminated = true;
+      if (e == std::string_view::npos) {
+        if (strict && (range[p] == '<'))
+          return false;
+        terminated = (range[p] != '<');
+        e = b;
+      }
+      std::string_view s = range.substr(p, e - p);
+      if (helpers::is_comment_fragment(s)) {
+      } else if (helpers::is_closing_tag(s)) {
+        open.close(s, p);
+        auto &span = open.top().spans->back().value;
+        span.close_length = s.size();
+        span.length = e - (open.top().content + span.offset);
+      } else {
+        open_t &parent = open.top();
+        parent.nodes->push_back(
+            {helpers::fragment_to_element(s, with_entities), {}});
+        node_span_t span;
+        span.offset = p - parent.content;
+        span.length = s.size();
+        if ((s.front() == '<') && terminated)
+          span.open_length = s.size(); // markup never merges with text
+        parent.spans->push_back({span, {}});
+        if (helpers::opens_element(s))
+          open.open({&parent.nodes->back().children,
+                     &parent.spans->back().children, e},
+                    s, p);
+      }
+      p = e;
+    }
+    open.finish();
+    return true;
+  }
+
+  /**
+   * adds delta to the length of every element on the path from the root
+   * down to path[level] and moves their later siblings
+   */
+  static void grow_path(std::vector<frame_t> &path, std::size_t level,
+                        std::ptrdiff_t delta) {
+    for (std::size_t i = 0; i <= level; i++) {
+      path[i].span->value.length += delta;
+      if (i == 0)
+        continue;
+      auto &siblings = path[i - 1].span->children;
+      for (auto s = std::next(path[i].span_it); s != siblings.end(); ++s)
+        s->value.offset += delta;
+    }
+  }
+
+  /**
+   * @brief replaces the value of the element whose opening tag was edited
+   *
+   * only if the tag still ends where it should, the edit starts after the
+   * name (so the closing tag still matches) and the tag still has the same
+   * kind
+   */
+  bool update_open_tag(std::string_view xml_text, std::vector<frame_t> &path,
+                       frame_t element, std::size_t begin,
+                       std::ptrdiff_t delta) {
+    node_span_t &span = element.span->value;
+    const std::size_t new_open_length = span.open_length + delta;
+    if (helpers::fragment_end(xml_text, element.start) !=
+        element.start + new_open_length)
+      return false;
+    std::string_view s = xml_text.substr(element.start, new_open_length);
+    if ((element.node->value.index() != 1) || (s[1] == '!') || (s[1] == '?') ||
+        helpers::is_closing_tag(s) ||
+        (begin <= element.start + 1 + helpers::element_name(s).size()) ||
+        (helpers::opens_element(s) != (span.close_length > 0)))
+      return false;
+    element.node->value = helpers::fragment_to_element(s, with_entities);
+    span.open_length = new_open_length;
+    path.push_back(element);
+    grow_path(path, path.size() - 1, delta);
+    path.pop_back();
+    return true;
+  }
+
+  /**
+   * @brief re-parses the children of path[level] around the edit
+   *
+   * the run covers children that overlap the edit, with text neighbours
+   * (they would merge with new text) and comments between them. Returns
+   * false if the new text of the run is not a balanced sequence of nodes.
+   */
+  bool splice(std::string_view xml_text, std::vector<frame_t> &path,
+              std::size_t level, std::size_t begin, std::size_t end,
+              std::ptrdiff_t delta, std::size_t &parsed) {
+    frame_t &f = path[level];
+    const node_span_t &parent = f.span->value;
+    const std::size_t content = f.start + parent.open_length;
+    auto &nodes = f.node->children;
+    auto &spans = f.span->children;
+    auto start_of = [&](std::list<span_node_t>::iterator s) {
+      return content + s->value.offset;
+    };
+    auto is_text = [](std::list<span_node_t>::iterator s) {
+      return s->value.open_length == 0;
+    };
+
+    // [first, last) are the children the edit touches
+    auto first = nodes.begin();
+    auto first_span = spans.begin();
+    for (; first != nodes.end(); ++first, ++first_span) {
+      const std::size_t e = start_of(first_span) + first_span->value.length;
+      if (is_text(first_span) ? (e >= begin) : (e > begin))
+        break;
+    }
+    auto last = first;
+    auto last_span = first_span;
+    for (; last != nodes.end(); ++last, ++last_span) {
+      const std::size_t s = start_of(last_span);
+      if (is_text(last_span) ? (s > end) : (s >= end))
+        break;
+    }
+    // text next to the run would merge with new text at its edges
+    if ((first != nodes.begin()) && is_text(std::prev(first_span))) {
+      --first;
+      --first_span;
+    }
+    if ((last != nodes.end()) && is_text(last_span)) {
+      ++last;
+      ++last_span;
+    }
+    const std::size_t run_begin =
+        (first == nodes.begin())
+            ? content
+            : start_of(std::prev(first_span)) +
+                  std::prev(first_span)->value.length;
+    const std::size_t run_end =
+        (last == nodes.end()) ? f.start + parent.length - parent.close_length
+                              : start_of(last_span);
+
+    std::list<node_t> new_nodes;
+    std::list<span_node_t> new_spans;
+    const std::size_t new_run_end = run_end + delta;
+    try {
+      if (!parse_range(xml_text, run_begin, new_run_end, true, new_nodes,
+                       new_spans))
+        return false;
+    } catch (const parse_error &) {
+      return false;
+    }
+    for (auto &s : new_spans)
+      s.value.offset += run_begin - content;
+
+    nodes.erase(first, last);
+    spans.erase(first_span, last_span);
+    nodes.splice(last, new_nodes);
+    spans.splice(last_span, new_spans);
+    for (auto s = last_span; s != spans.end(); ++s)
+      s->value.offset += delta;
+    grow_path(path, level, delta);
+    parsed = new_run_end - run_begin;
+    return true;
+  }
+};
+
+} // namespace xml
+} // namespace tp
+
+#endif
@@ -0,0 +1,178 @@
+
+/*
+FUNCTIONS:
+
+inline tree_elem_t<element_t> text_to_xml_parallel(std::string_view xml_text,
+    bool with_entities = false,
+    unsigned threads = std::thread::hardware_concurrency());
+
+Gives the same tree as text_to_xml (or text_to_xml_with_entities), parsed on
+many threads. The text is split at '<' characters into chunks, every chunk
+is tokenized and built into subtrees on a worker, and the subtrees are then
+spliced together following the open and close tags left over at chunk
+edges. A split point that turns out to be inside a comment, CDATA or
+attribute value is detected and that part is parsed again from the right
+place. Structure errors are reported exactly as text_to_xml reports them.
+
+*/
+
+#ifndef __TP_XML_PARALLEL_HPP__
+#define __TP_XML_PARALLEL_HPP__
+
+#include <tp_tree_xml.hpp>
+
+#include <atomic>
+#include <exception>
+#include <thread>
+
+namespace tp {
+namespace xml {
+namespace helpers {
+
+/**
+ * subtrees parsed from one chunk of text. items are the top level nodes,
+ * closes are closing tags that did not match anything inside the chunk
+ * (before is the number of items that precede it) and open is the path of
+ * elements still open at the end of the chunk.
+ * */
+struct chunk_tree_t {
+  struct tag_ref_t {
+    std::size_t before;
+    std::string_view fragment;
+    std::size_t offset;
+  };
+  std::size_t begin = 0;
+  std::size_t end = 0;
+  std::list<tree_elem_t<element_t>> items;
+  std::vector<tag_ref_t> closes;
+  std::vector<std::pair<tree_elem_t<element_t> *, tag_ref_t>> open;
+  std::exception_ptr error;
+};
+
+/**
+ * @brief parses fragments that start in [begin, limit) of xml_text
+ *
+ * the last fragment may reach past limit; end is where it stops.
+ */
+inline void parse_chunk(std::string_view xml_text, std::size_t begin,
+                        std::size_t limit, bool with_entities,
+                        chunk_tree_t &chunk) {
+  chunk = chunk_tree_t();
+  chunk.begin = begin;
+  try {
+    std::size_t p = begin;
+    while (p < limit) {
+      std::size_t e = fragment_end(xml_text, p);
+      if (e == std::string_view::npos)
+        e = xml_text.size();
+      std::string_view s = xml_text.substr(p, e - p);
+      if (!is_comment_fragment(s)) {
+        if (is_closing_tag(s)) {
+          if (chunk.open.empty()) {
+            chunk.closes.push_back({chunk.items.size(), s, p});
+          } else {
+            if (element_name(chunk.open.back().second.fragment) !=
+                element_name(s))
+              throw parse_error("mismatched closing tag", p);
+            chunk.open.pop_back();
+          }
+        } else {
+          auto &children = chunk.open.empty()
+                               ? chunk.items
+                               : chunk.open.back().first->children;
+          children.push_back({fragment_to_element(s, with_entities), {}});
+          if (opens_element(s))
+            chunk.open.push_back({&children.back(), {0, s, p}});
+        }
+      }
+      p = e;
+    }
+    chunk.end = p;
+  } catch (...) {
+    chunk.error = std::current_exception();
+  }
+}
+
+/**
+ * @brief appends the chunk subtrees to the tree that is being built
+ */
+inline void stitch_chunk(chunk_tree_t &chunk,
+                         element_stack_t<tree_elem_t<element_t> *> &open) {
+  auto close = chunk.closes.begin();
+  for (std::size_t i = 0;; i++) {
+    for (; (close != chunk.closes.end()) && (close->before == i); ++close)
+      open.close(close->fragment, close->offset);
+    if (chunk.items.empty())
+      break;
+    auto &children = open.top()->children;
+    children.splice(children.end(), chunk.items, chunk.items.begin());
+  }
+  for (auto &[node, tag] : chunk.open)
+    open.open(node, tag.fragment, tag.offset);
+}
+
+} // namespace helpers
+
+inline tree_elem_t<element_t>
+text_to_xml_parallel(std::string_view xml_text, bool with_entities = false,
+                     unsigned threads = std::thread::hardware_concurrency()) {
+  static constexpr std::size_t min_chunk_size = 256 * 1024;
+  const std::size_t chunk_count = std::min<std::size_t>(
+      std::size_t(std::max(threads, 1u)) * 4, xml_text.size() / min_chunk_size);
+  if ((threads < 2) || (chunk_count < 2))
+    return helpers::build_tree(xml_text, with_entities);
+
+  // chunk i covers fragments starting in [starts[i], starts[i + 1])
+  std::vector<std::size_t> starts = {0};
+  for (std::size_t i = 1; i < chunk_count; i++) {
+    std::size_t p = xml_text.find('<', i * xml_text.size() / chunk_count);
+    if (p == std::string_view::npos)
+      break;
+    if (p > starts.back())
+      starts.push_back(p);
+  }
+  starts.push_back(xml_text.size());
+
+  std::vector<helpers::chunk_tree_t> chunks(starts.size() - 1);
+  std::atomic<std::size_t> next_chunk(0);
+  auto worker = [&]() {
+    for (std::size_t i = next_chunk++; i < chunks.size(); i = next_chunk++)
+      helpers::parse_chunk(xml_text, starts[i], starts[i + 1], with_entities,
+                           chunks[i]);
+  };
+  std::vector<std::thread> pool;
+  for (unsigned i = 1; i < std::min<std::size_t>(threads, chunks.size()); i++)
+    pool.emplace_back(worker);
+  worker();
+  for (auto &t : pool)
+    t.join();
+
+  try {
+    tree_elem_t<element_t> root;
+    helpers::element_stack_t<tree_elem_t<element_t> *> open(&root);
+    std::size_t cursor = 0;
+    for (std::size_t i = 0; i < chunks.size(); i++) {
+      if (cursor >= starts[i + 1])
+        continue; // already covered by the previous chunk
+      if (chunks[i].begin != cursor) {
+        // the split point was not a fragment boundary, parse from the real one
+        helpers::parse_chunk(xml_text, cursor, starts[i + 1], with_entities,
+                             chunks[i]);
+      }
+      if (chunks[i].error)
+        std::rethrow_exception(chunks[i].error);
+      helpers::stitch_chunk(chunks[i], open);
+      cursor = chunks[i].end;
+    }
+    open.finish();
+    return root;
+  } catch (const parse_error &) {
+    // report the error exactly as the sequential parser does
+    return helpers::build_tree(xml_text, with_entities);
+  }
+}
+
+} // namespace xml
+} // namespace tp
+
+#endif
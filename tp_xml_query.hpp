@@ -0,0 +1,347 @@
+
+/*
+TYPES:
+
+class query_t;     // compiled XPath subset expression
+class tag_index_t; // tag name -> nodes in document order
+
+FUNCTIONS:
+
+query_t q("//g[@id='layer1']/path");
+std::vector<const tree_elem_t<element_t> *> nodes = q.select(tree);
+std::vector<std::string_view> ds = query_t("//path/@d").values(tree);
+
+inline tree_elem_t<element_t> text_to_xml_indexed(std::string_view xml_text,
+    tag_index_t &index, bool with_entities = true);
+
+Supported expressions:
+
+  /name, //name, *        child and descendant steps, any tag
+  [@attr]                 tag has the attribute
+  [@attr='value']         attribute equals value (or "value")
+  [n]                     n-th matching tag among its siblings (from 1)
+  /@attr as the last step selects attribute values (values())
+
+Expressions are compiled once. Names are interned, so matching compares
+integers. When a tag_index_t is given and the expression starts with
+//name, the candidates come from the index instead of a walk over the
+whole document. For any other root (a subtree) the index is ignored.
+
+*/
+
+#ifndef __TP_XML_QUERY_HPP__
+#define __TP_XML_QUERY_HPP__
+
+#include <tp_tree_xml.hpp>
+
+#include <unordered_set>
+
+namespace tp {
+namespace xml {
+
+/**
+ * nodes of every tag name in document order, see text_to_xml_indexed
+ * */
+class tag_index_t {
+public:
+  using node_t = tree_elem_t<element_t>;
+
+  void add(const node_t &node) {
+    if (!first)
+      first = &node;
+    if (node.value.index() == 1)
+      nodes[std::get<1>(node.value).tag.atom].push_back(&node);
+  }
+  const std::vector<const node_t *> &find(name_t name) const {
+    static const std::vector<const node_t *> none;
+    auto found = nodes.find(name.atom);
+    return (found == nodes.end()) ? none : found->second;
+  }
+  void clear() {
+    nodes.clear();
+    first = nullptr;
+  }
+  /**
+   * true if root is the root of the indexed document. The first node added
+   * is the first child of that root, and list nodes never move.
+   */
+  bool covers(const node_t &root) const {
+    return first && !root.children.empty() && (&root.children.front() == first);
+  }
+
+private:
+  std::unordered_map<std::uint32_t, std::vector<const node_t *>> nodes;
+  const node_t *first = nullptr;
+};
+
+/**
+ * @brief parses xml text and fills the tag index on the way
+ */
+inline tree_elem_t<element_t> text_to_xml_indexed(std::string_view xml_text,
+                                                  tag_index_t &index,
+                                                  bool with_entities = true) {
+  index.clear();
+  return helpers::build_tree(xml_text, with_entities,
+                             [&](tree_elem_t<element_t> &n) { index.add(n); });
+}
+
+class query_t {
+public:
+  using node_t = tree_elem_t<element_t>;
+
+  /**
+   * compiles the expression, throws std::invalid_argument if it is not in
+   * the supported subset
+   */
+  explicit query_t(std::string_view expression) {
+    std::size_t p = 0;
+    auto fail = [&](const std::string &why) {
+      throw std::invalid_argument("query_t: " + why + " at " +
+                                  std::to_string(p) + " in \"" +
+                                  std::string(expression) + "\"");
+    };
+    auto name = [&]() {
+      std::size_t a = p;
+      // tag names may contain '@', '[' and ']', expressions use them
+      while ((p < expression.size()) && helpers::is_name_char(expression[p]) &&
+             (expression[p] != '@') && (expression[p] != '[') &&
+             (expression[p] != ']'))
+        p++;
+      if (a == p)
+        fail("name expected");
+      return expression.substr(a, p - a);
+    };
+    while (p < expression.size()) {
+      step_t step;
+      if (expression.substr(p, 2) == "//") {
+        step.descendant = true;
+        p += 2;
+      } else if (expression[p] == '/') {
+        p++;
+      } else if (!steps.empty()) {
+        fail("'/' expected");
+      }
+      if ((p < expression.size()) && (expression[p] == '@')) {
+        p++;
+        result_attr = name_t(name());
+        if (p != expression.size())
+          fail("attribute must be the last step");
+        break;
+      }
+      if ((p < expression.size()) && (expression[p] == '*')) {
+        step.any_name = true;
+        p++;
+      } else {
+        step.name = name_t(name());
+      }
+      while ((p < expression.size()) && (expression[p] == '[')) {
+        p++;
+        predicate_t pred;
+        if ((p < expression.size()) && (expression[p] == '@')) {
+          p++;
+          pred.attr = name_t(name());
+          if ((p < expression.size()) && (expression[p] == '=')) {
+            p++;
+            if ((p >= expression.size()) ||
+                ((expression[p] != '\'') && (expression[p] != '"')))
+              fail("quoted value expected");
+            auto e = expression.find(expression[p], p + 1);
+            if (e == std::string_view::npos)
+              fail("unterminated value");
+            pred.has_value = true;
+            pred.value = expression.substr(p + 1, e - p - 1);
+            p = e + 1;
+          }
+        } else {
+          std::size_t a = p;
+          while ((p < expression.size()) && (expression[p] >= '0') &&
+                 (expression[p] <= '9'))
+            pred.position = pred.position * 10 + (expression[p++] - '0');
+          if ((a == p) || (pred.position == 0))
+            fail("position or @attribute expected");
+        }
+        if ((p >= expression.size()) || (expression[p] != ']'))
+          fail("']' expected");
+        p++;
+        step.predicates.push_back(pred);
+      }
+      steps.push_back(std::move(step));
+    }
+    if (steps.empty())
+      fail("empty expression");
+  }
+
+  /**
+   * tags matching the expression, in document order. The index is used only
+   * when root is the document it was built for; a subtree root is walked,
+   * so the results never come from outside of it.
+   */
+  std::vector<const node_t *> select(const node_t &root,
+                                     const tag_index_t *index = nullptr) const {
+    std::vector<const node_t *> current;
+    std::size_t first = 0;
+    const step_t &s0 = steps.front();
+    if (index && index->covers(root) && s0.descendant && !s0.any_name &&
+        !has_position(s0)) {
+      for (auto n : index->find(s0.name))
+        if (matches_attributes(s0, *n))
+          current.push_back(n);
+      first = 1;
+    } else {
+      current.push_back(&root);
+    }
+    std::vector<const node_t *> next;
+    std::vector<const node_t *> candidates;
+    std::unordered_set<const node_t *> visited;
+    struct frame_t {
+      const node_t *node;
+      std::list<node_t>::const_iterator child;
+      std::size_t begin;    // candidates of this node are [begin, end)
+      std::size_t accepted; // next one to emit
+      std::size_t end;
+    };
+    std::vector<frame_t> stack;
+    for (std::size_t i = first; i < steps.size(); i++) {
+      const step_t &step = steps[i];
+      next.clear();
+      visited.clear();
+      // candidates of parent appended to the candidates vector
+      auto accept = [&](const node_t &parent) {
+        std::size_t begin = candidates.size();
+        for (auto &c : parent.children)
+          if (matches_name(step, c))
+            candidates.push_back(&c);
+        apply_predicates(step, candidates, begin);
+        return begin;
+      };
+      for (auto ctx : current) {
+        candidates.clear();
+        if (!step.descendant) {
+          accept(*ctx);
+          next.insert(next.end(), candidates.begin(), candidates.end());
+          continue;
+        }
+        // nested contexts were already searched from their ancestor
+        if (!visited.insert(ctx).second)
+          continue;
+        // every node of the subtree is a parent for the child test, walk it
+        // in document order so results come out in document order
+        std::size_t begin = accept(*ctx);
+        stack.push_back(
+            {ctx, ctx->children.begin(), begin, begin, candidates.size()});
+        while (!stack.empty()) {
+          frame_t &f = stack.back();
+          if (f.child == f.node->children.end()) {
+            candidates.resize(f.begin); // frames own the top of candidates
+            stack.pop_back();
+            continue;
+          }
+          const node_t &c = *f.child++;
+          if ((f.accepted < f.end) && (candidates[f.accepted] == &c)) {
+            next.push_back(&c);
+            f.accepted++;
+          }
+          if (!c.children.empty() && visited.insert(&c).second) {
+            std::size_t begin = accept(c);
+            stack.push_back(
+                {&c, c.children.begin(), begin, begin, candidates.size()});
+          }
+        }
+      }
+      current.swap(next);
+    }
+    return current;
+  }
+
+  /**
+   * values of the attribute selected by the final /@name step
+   */
+  std::vector<std::string_view> values(const node_t &root,
+                                       const tag_index_t *index = nullptr) const {
+    if (result_attr.empty())
+      throw std::invalid_argument("query_t: expression does not end with /@name");
+    std::vector<std::string_view> ret;
+    for (auto n : select(root, index)) {
+      auto &attr = std::get<1>(n->value).attr;
+      auto found = attr.find(result_attr);
+      if (found != attr.end())
+        ret.push_back(found->second);
+    }
+    return ret;
+  }
+
+private:
+  struct predicate_t {
+    name_t attr;
+    bool has_value = false;
+    std::string value;
+    std::size_t position = 0;
+  };
+  struct step_t {
+    bool descendant = false;
+    bool any_name = false;
+    name_t name;
+    std::vector<predicate_t> predicates;
+  };
+  std::vector<step_t> steps;
+  name_t result_attr;
+
+  static bool has_position(const step_t &step) {
+    for (auto &pred : step.predicates)
+      if (pred.position)
+        return true;
+    return false;
+  }
+
+  static bool matches_name(const step_t &step, const node_t &n) {
+    if (n.value.index() != 1)
+      return false;
+    auto &tag = std::get<1>(n.value);
+    return step.any_name ? !tag.is_markup() : (tag.tag == step.name);
+  }
+
+  static bool matches_attribute(const predicate_t &pred, const node_t &n) {
+    auto &attr = std::get<1>(n.value).attr;
+    auto found = attr.find(pred.attr);
+    return (found != attr.end()) &&
+           (!pred.has_value || (found->second == pred.value));
+  }
+
+  static bool matches_attributes(const step_t &step, const node_t &n) {
+    for (auto &pred : step.predicates)
+      if (!matches_attribute(pred, n))
+        return false;
+    return true;
+  }
+
+  /**
+   * filters candidates from begin on, the children of one parent
+   */
+  static void apply_predicates(const step_t &step,
+                               std::vector<const node_t *> &candidates,
+                               std::size_t begin) {
+    for (auto &pred : step.predicates) {
+      if (pred.position) {
+        if (pred.position > candidates.size() - begin) {
+          candidates.resize(begin);
+        } else {
+          const node_t *n = candidates[begin + pred.position - 1];
+          candidates.resize(begin + 1);
+          candidates[begin] = n;
+        }
+      } else {
+        candidates.erase(std::remove_if(candidates.begin() + begin,
+                                        candidates.end(),
+                                        [&](const node_t *n) {
+                                          return !matches_attribute(pred, *n);
+                                        }),
+                         candidates.end());
+      }
+    }
+  }
+};
+
+} // namespace xml
+} // namespace tp
+
+#endif
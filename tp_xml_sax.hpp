@@ -0,0 +1,284 @@
+
+/*
+TYPES:
+
+enum event_type_e { START_ELEMENT, END_ELEMENT, TEXT, MARKUP };
+
+struct event_t {
+  event_type_e type;
+  std::string_view name;  // element name, or the whole <!...>/<?...?> markup
+  std::string_view text;  // TEXT only
+  std::vector<flat_attr_t> attrs; // START_ELEMENT only
+  std::size_t offset;     // byte offset of the fragment in the stream
+};
+
+class event_reader_t; // pull parser over std::istream, fd or read function
+
+FUNCTIONS:
+
+template <class F> void parse_events(std::istream &in, F on_event);
+template <class F> void parse_events(int fd, F on_event);
+
+Views in event_t are valid until the next call to event_reader_t::next.
+Memory used is the chunk size plus the longest single fragment (tag or
+text run without entities is split into chunk sized pieces).
+
+*/
+
+#ifndef __TP_XML_SAX_HPP__
+#define __TP_XML_SAX_HPP__
+
+#include <tp_tree_xml.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <unistd.h>
+
+namespace tp {
+namespace xml {
+
+enum event_type_e { START_ELEMENT,
+                    END_ELEMENT,
+                    TEXT,
+                    MARKUP };
+
+struct event_t {
+  event_type_e type = TEXT;
+  std::string_view name;
+  std::string_view text;
+  std::vector<flat_attr_t> attrs;
+  std::size_t offset = 0;
+};
+
+/**
+ * @brief pull parser that reads xml in fixed size chunks
+ *
+ * <a/> gives START_ELEMENT and END_ELEMENT. Comments are skipped, CDATA is
+ * reported as TEXT. Structure errors are thrown as parse_error.
+ * */
+class event_reader_t {
+public:
+  using read_function_t = std::function<std::size_t(char *, std::size_t)>;
+
+  event_reader_t(read_function_t read_function,
+                 std::size_t chunk_size = 64 * 1024,
+                 bool with_entities = true)
+      : read_function(std::move(read_function)), chunk_size(chunk_size),
+        with_entities(with_entities) {}
+
+  explicit event_reader_t(std::istream &in, std::size_t chunk_size = 64 * 1024,
+                          bool with_entities = true)
+      : event_reader_t(
+            [&in](char *dst, std::size_t n) -> std::size_t {
+              in.read(dst, n);
+              return in.gcount();
+            },
+            chunk_size, with_entities) {}
+
+  explicit event_reader_t(int fd, std::size_t chunk_size = 64 * 1024,
+                          bool with_entities = true)
+      : event_reader_t(
+            [fd](char *dst, std::size_t n) -> std::size_t {
+              for (;;) {
+                auto r = ::read(fd, dst, n);
+                if (r >= 0)
+                  return r;
+                if (errno != EINTR)
+                  throw std::system_error(errno, std::generic_category(),
+                                          "event_reader_t read");
+              }
+            },
+            chunk_size, with_entities) {}
+
+  /**
+   * reads next event. Returns false at the end of the document.
+   */
+  bool next(event_t &e) {
+    e.attrs.clear();
+    e.text = {};
+    if (pending_end) { // e.name still holds the name of <a/>
+      pending_end = false;
+      e.type = END_ELEMENT;
+      return true;
+    }
+    for (;;) {
+      if ((pos == buffer.size()) && !fill()) {
+        if (!open_names.empty())
+          throw parse_error("element <" + open_names.back() + "> is not closed",
+                            open_offsets.back());
+        return false;
+      }
+      std::string_view buf(buffer);
+      std::size_t end = helpers::fragment_end(buf, pos);
+      if ((end == std::string_view::npos) && eof)
+        end = buf.size();
+      if ((end == std::string_view::npos) && (buf[pos] != '<'))
+        end = text_cut(buf);
+      if ((end == std::string_view::npos) || (end == pos)) {
+        fill();
+        continue;
+      }
+      std::string_view fragment = buf.substr(pos, end - pos);
+      e.offset = consumed + pos;
+      pos = end;
+      if (helpers::is_comment_fragment(fragment))
+        continue;
+      to_event(fragment, e);
+      return true;
+    }
+  }
+
+private:
+  read_function_t read_function;
+  std::size_t chunk_size;
+  bool with_entities;
+
+  std::string buffer;
+  std::size_t pos = 0;
+  std::size_t consumed = 0; // bytes dropped from the front of the buffer
+  bool eof = false;
+
+  std::vector<std::string> open_names;
+  std::vector<std::size_t> open_offsets;
+  bool pending_end = false;
+  std::string scratch;
+  std::vector<flat_attr_t> raw_attrs;
+  std::vector<std::size_t> value_ends;
+
+  bool fill() {
+    if (eof)
+      return false;
+    buffer.erase(0, pos);
+    consumed += pos;
+    pos = 0;
+    const std::size_t old_size = buffer.size();
+    buffer.resize(old_size + chunk_size);
+    std::size_t n = read_function(buffer.data() + old_size, chunk_size);
+    buffer.resize(old_size + n);
+    eof = (n == 0);
+    return n > 0;
+  }
+
+  /**
+   * end of the piece of a long unterminated text run that can be reported
+   * now: the whole buffer, but not past an entity that is not complete yet.
+   * npos if the run is still shorter than one chunk. The run is cut anyway
+   * once it is longer than any entity past the chunk, also for chunks
+   * smaller than an entity.
+   */
+  std::size_t text_cut(std::string_view buf) const {
+    if (buf.size() - pos < chunk_size)
+      return std::string_view::npos;
+    auto amp = buf.rfind('&');
+    const std::size_t limit =
+        std::max(2 * chunk_size, chunk_size + helpers::max_entity_size);
+    if (!with_entities || (amp == std::string_view::npos) || (amp < pos) ||
+        (buf.find(';', amp) != std::string_view::npos) ||
+        (buf.size() - pos > limit))
+      return buf.size();
+    return amp;
+  }
+
+  std::string decode(std::string_view raw, bool escapes) const {
+    std::string s(raw);
+    if (escapes && (raw.find('\\') != std::string_view::npos))
+      s.resize(helpers::unescape_value(s, s.data()) - s.data());
+    if (with_entities)
+      helpers::decode_entities_in_place(s);
+    return s;
+  }
+
+  void to_event(std::string_view fragment, event_t &e) {
+    scratch.clear();
+    if (helpers::is_closing_tag(fragment)) {
+      e.type = END_ELEMENT;
+      e.name = helpers::element_name(fragment);
+      if (open_names.empty())
+        throw parse_error("unexpected closing tag </" + std::string(e.name) + ">",
+                          e.offset);
+      if (open_names.back() != e.name)
+        throw parse_error("closing tag </" + std::string(e.name) +
+                              "> does not match <" + open_names.back() +
+                              "> (opened at byte " +
+                              std::to_string(open_offsets.back()) + ")",
+                          e.offset);
+      open_names.pop_back();
+      open_offsets.pop_back();
+    } else if (fragment.substr(0, 9) == "<![CDATA[") {
+      e.type = TEXT;
+      e.text = fragment.substr(9, fragment.size() - 12);
+    } else if ((fragment.size() > 1) && (fragment[0] == '<') &&
+               (fragment.back() == '>')) {
+      if ((fragment[1] == '!') || (fragment[1] == '?')) {
+        e.type = MARKUP;
+        e.name = fragment;
+        return;
+      }
+      e.type = START_ELEMENT;
+      raw_attrs.clear();
+      e.name = helpers::scan_tag(
+          fragment, [&](std::string_view name, std::string_view value) {
+            raw_attrs.push_back({name, value});
+          });
+      // decode all values first, scratch must not grow while views exist
+      value_ends.clear();
+      for (auto &a : raw_attrs) {
+        std::string_view v = a.value;
+        if ((v.find('\\') != std::string_view::npos) ||
+            (with_entities && (v.find('&') != std::string_view::npos)))
+          scratch += decode(v, true);
+        else
+          scratch += v;
+        value_ends.push_back(scratch.size());
+      }
+      std::size_t begin = 0;
+      for (std::size_t i = 0; i < raw_attrs.size(); i++) {
+        e.attrs.push_back(
+            {raw_attrs[i].name,
+             std::string_view(scratch).substr(begin, value_ends[i] - begin)});
+        begin = value_ends[i];
+      }
+      if (helpers::opens_element(fragment)) {
+        open_names.emplace_back(e.name);
+        open_offsets.push_back(e.offset);
+      } else {
+        pending_end = true;
+      }
+    } else {
+      e.type = TEXT;
+      if (with_entities && (fragment.find('&') != std::string_view::npos)) {
+        scratch = decode(fragment, false);
+        e.text = scratch;
+      } else {
+        e.text = fragment;
+      }
+    }
+  }
+};
+
+/**
+ * @brief push interface: calls on_event(const event_t &) for every event
+ */
+template <class F>
+inline void parse_events(std::istream &in, F on_event,
+                         std::size_t chunk_size = 64 * 1024) {
+  event_reader_t reader(in, chunk_size);
+  event_t e;
+  while (reader.next(e))
+    on_event(static_cast<const event_t &>(e));
+}
+
+template <class F>
+inline void parse_events(int fd, F on_event,
+                         std::size_t chunk_size = 64 * 1024) {
+  event_reader_t reader(fd, chunk_size);
+  event_t e;
+  while (reader.next(e))
+    on_event(static_cast<const event_t &>(e));
+}
+
+} // namespace xml
+} // namespace tp
+
+#endif
@@ -0,0 +1,489 @@
+
+/*
+TYPES:
+
+struct snapshot_key_t;    // source size, mtime and parse mode
+class snapshot_t;         // parsed tree read in place from a binary snapshot
+class snapshot_element_t; // view of one node, like flat_element_t
+
+FUNCTIONS:
+
+inline std::string snapshot_bytes(const flat_document_t &doc,
+    const snapshot_key_t &key = {});
+inline void write_snapshot(const std::string &path,
+    const flat_document_t &doc, const snapshot_key_t &key = {});
+inline snapshot_t load_or_parse(const std::string &source_path,
+    bool with_entities = true);
+
+walk_tree, walk_tree_io and walk_tags work on snapshot_t like on
+flat_document_t.
+
+File layout (host byte order, every table aligned to 8 bytes):
+
+  snapshot_header_t   magic, version, byte order mark, key, table sizes
+                      and offsets, checksum of the header
+  snapshot_node_t[]   node 0 is the root, children linked by index
+  snapshot_attr_t[]   attributes of each node are one run of this table
+  char[]              string table, tag and attribute names stored once
+
+A snapshot is used straight from the mapped file: nothing is allocated per
+node and nothing is fixed up. Loading checks every record once, so a damaged
+snapshot is rejected instead of being read out of bounds. load_or_parse keeps
+the snapshot next to the source as <source>.tpxs and uses it while the size
+and mtime of the source match; otherwise (or when the snapshot is rejected)
+it parses the source and writes the snapshot again.
+
+*/
+
+#ifndef __TP_XML_SNAPSHOT_HPP__
+#define __TP_XML_SNAPSHOT_HPP__
+
+#include <tp_mapped_file.hpp>
+#include <tp_output_sink.hpp>
+#include <tp_tree_xml.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <thread>
+
+namespace tp {
+namespace xml {
+
+struct snapshot_key_t {
+  std::uint64_t source_size = 0;
+  std::int64_t source_mtime = 0; // nanoseconds since the epoch
+  bool with_entities = true;
+
+  /**
+   * key of the file as it is now
+   */
+  static snapshot_key_t of_file(const std::string &path, bool with_entities) {
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0)
+      throw std::system_error(errno, std::generic_category(), path);
+    return {std::uint64_t(st.st_size),
+            std::int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec,
+            with_entities};
+  }
+};
+
+struct snapshot_header_t {
+  static constexpr std::uint32_t current_version = 1;
+  static constexpr std::uint32_t byte_order_mark = 0x01020304;
+
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t byte_order;
+  std::uint64_t source_size;
+  std::int64_t source_mtime;
+  std::uint32_t with_entities;
+  std::uint32_t reserved;
+  std::uint64_t node_count;
+  std::uint64_t attr_count;
+  std::uint64_t strings_size;
+  std::uint64_t nodes_offset;
+  std::uint64_t attrs_offset;
+  std::uint64_t strings_offset;
+  std::uint64_t checksum;
+};
+
+struct snapshot_node_t {
+  static constexpr std::uint32_t npos = ~std::uint32_t(0);
+  std::uint64_t value_offset; // tag name or text in the string table
+  std::uint32_t value_length;
+  std::uint32_t first_child;
+  std::uint32_t next_sibling;
+  std::uint32_t attr_begin;
+  std::uint32_t attr_count;
+  std::uint32_t is_tag;
+};
+
+struct snapshot_attr_t {
+  std::uint64_t name_offset;
+  std::uint64_t value_offset;
+  std::uint32_t name_length;
+  std::uint32_t value_length;
+};
+
+namespace helpers {
+
+inline const char snapshot_magic[8] = {'T', 'P', 'X', 'M', 'L', 'S', 'N', 'P'};
+
+/**
+ * FNV-1a of the header without the checksum field
+ */
+inline std::uint64_t snapshot_header_checksum(const snapshot_header_t &h) {
+  auto p = reinterpret_cast<const unsigned char *>(&h);
+  std::uint64_t hash = 0xcbf29ce484222325ull;
+  for (std::size_t i = 0; i < offsetof(snapshot_header_t, checksum); i++)
+    hash = (hash ^ p[i]) * 0x100000001b3ull;
+  return hash;
+}
+
+inline std::uint64_t align_8(std::uint64_t n) { return (n + 7) & ~7ull; }
+
+} // namespace helpers
+
+class snapshot_t;
+
+/**
+ * view of one node of snapshot_t, passed to the walk_tree callbacks. Has the
+ * interface of flat_element_t.
+ * */
+class snapshot_element_t {
+public:
+  const snapshot_t *doc;
+  std::uint32_t node;
+
+  inline const snapshot_node_t &get() const;
+  std::size_t index() const { return get().is_tag ? 1 : 0; }
+  inline std::string_view text() const;
+  std::string_view tag() const { return text(); }
+  /**
+   * value of the attribute, or empty view if there is no such attribute
+   */
+  inline std::string_view attr(std::string_view name) const;
+  /**
+   * calls f(std::string_view name, std::string_view value) for every
+   * attribute in document order
+   */
+  template <class F> void for_each_attr(F f) const;
+};
+
+class snapshot_t {
+public:
+  const snapshot_node_t *nodes = nullptr;
+  const snapshot_attr_t *attrs = nullptr;
+
+  /**
+   * maps the snapshot file. Throws std::runtime_error if it is not a valid
+   * snapshot, std::system_error if it cannot be read.
+   */
+  explicit snapshot_t(const std::string &path)
+      : file(std::make_unique<mapped_file_t>(path)) {
+    attach(file->view());
+  }
+
+  /**
+   * snapshot kept in memory, for example from snapshot_bytes
+   */
+  static snapshot_t from_bytes(std::string bytes) {
+    return snapshot_t(in_memory_t(), std::move(bytes));
+  }
+
+  snapshot_t(snapshot_t &&) = default;
+  snapshot_t &operator=(snapshot_t &&) = default;
+
+  const snapshot_header_t &header() const { return *header_ptr; }
+  snapshot_key_t key() const {
+    return {header().source_size, header().source_mtime,
+            header().with_entities != 0};
+  }
+  std::size_t size() const { return header().node_count; }
+  snapshot_element_t root() const { return {this, 0}; }
+
+  std::string_view str(std::uint64_t offset, std::uint32_t length) const {
+    return {strings + offset, length};
+  }
+
+private:
+  std::unique_ptr<mapped_file_t> file;
+  std::string buffer;
+  const snapshot_header_t *header_ptr = nullptr;
+  const char *strings = nullptr;
+
+  struct in_memory_t {};
+  snapshot_t(in_memory_t, std::string bytes) : buffer(std::move(bytes)) {
+    attach(buffer);
+  }
+
+  /**
+   * checks that the header and the tables fit in data, sets the table
+   * pointers and validates every record (see validate), so a damaged file is
+   * rejected here and never read out of bounds later.
+   */
+  void attach(std::string_view data) {
+    auto fail = [](const char *why) {
+      throw std::runtime_error(std::string("snapshot: ") + why);
+    };
+    if (data.size() < sizeof(snapshot_header_t))
+      fail("file too short");
+    if (reinterpret_cast<std::uintptr_t>(data.data()) % 8)
+      fail("data not aligned");
+    header_ptr = reinterpret_cast<const snapshot_header_t *>(data.data());
+    const snapshot_header_t &h = *header_ptr;
+    if (std::memcmp(h.magic, helpers::snapshot_magic, sizeof(h.magic)) != 0)
+      fail("bad magic");
+    if (h.byte_order != snapshot_header_t::byte_order_mark)
+      fail("written with other byte order");
+    if (h.version != snapshot_header_t::current_version)
+      fail("unsupported version");
+    if (h.checksum != helpers::snapshot_header_checksum(h))
+      fail("header checksum mismatch");
+    auto fits = [&](std::uint64_t offset, std::uint64_t count,
+                    std::uint64_t record) {
+      return (offset % 8 == 0) && (offset <= data.size()) &&
+             (count <= (data.size() - offset) / record);
+    };
+    if ((h.node_count < 1) || (h.node_count >= snapshot_node_t::npos) ||
+        !fits(h.nodes_offset, h.node_count, sizeof(snapshot_node_t)) ||
+        !fits(h.attrs_offset, h.attr_count, sizeof(snapshot_attr_t)) ||
+        !fits(h.strings_offset, h.strings_size, 1))
+      fail("tables out of the file");
+    nodes = reinterpret_cast<const snapshot_node_t *>(data.data() +
+                                                      h.nodes_offset);
+    attrs = reinterpret_cast<const snapshot_attr_t *>(data.data() +
+                                                      h.attrs_offset);
+    strings = data.data() + h.strings_offset;
+    validate();
+  }
+
+  /**
+   * checks every string range against the string table, every attribute run
+   * against the attribute table and the child and sibling links. Links must
+   * point forward (nodes are stored in document order) and every node but
+   * the root must be linked exactly once, so the links form one tree and the
+   * walks end.
+   */
+  void validate() const {
+    auto fail = [](const char *why) {
+      throw std::runtime_error(std::string("snapshot: ") + why);
+    };
+    const snapshot_header_t &h = header();
+    auto in_strings = [&](std::uint64_t offset, std::uint32_t length) {
+      return (offset <= h.strings_size) && (length <= h.strings_size - offset);
+    };
+    for (std::uint64_t i = 0; i < h.attr_count; i++)
+      if (!in_strings(attrs[i].name_offset, attrs[i].name_length) ||
+          !in_strings(attrs[i].value_offset, attrs[i].value_length))
+        fail("attribute string out of the string table");
+    std::vector<bool> linked(h.node_count, false);
+    auto link = [&](std::uint64_t from, std::uint32_t to) {
+      if (to == snapshot_node_t::npos)
+        return;
+      if ((to <= from) || (to >= h.node_count) || linked[to])
+        fail("bad node link");
+      linked[to] = true;
+    };
+    for (std::uint64_t i = 0; i < h.node_count; i++) {
+      const snapshot_node_t &n = nodes[i];
+      if (!in_strings(n.value_offset, n.value_length))
+        fail("node string out of the string table");
+      if ((n.attr_begin > h.attr_count) ||
+          (n.attr_count > h.attr_count - n.attr_begin))
+        fail("attributes out of the attribute table");
+      link(i, n.first_child);
+      link(i, n.next_sibling);
+    }
+    if (nodes[0].next_sibling != snapshot_node_t::npos)
+      fail("root has a sibling");
+    for (std::uint64_t i = 1; i < h.node_count; i++)
+      if (!linked[i])
+        fail("node not linked");
+  }
+};
+
+inline const snapshot_node_t &snapshot_element_t::get() const {
+  return doc->nodes[node];
+}
+inline std::string_view snapshot_element_t::text() const {
+  return doc->str(get().value_offset, get().value_length);
+}
+inline std::string_view snapshot_element_t::attr(std::string_view name) const {
+  const snapshot_attr_t *a = doc->attrs + get().attr_begin;
+  for (const snapshot_attr_t *e = a + get().attr_count; a != e; ++a)
+    if (doc->str(a->name_offset, a->name_length) == name)
+      return doc->str(a->value_offset, a->value_length);
+  return {};
+}
+template <class F> void snapshot_element_t::for_each_attr(F f) const {
+  const snapshot_attr_t *a = doc->attrs + get().attr_begin;
+  for (const snapshot_attr_t *e = a + get().attr_count; a != e; ++a)
+    f(doc->str(a->name_offset, a->name_length),
+      doc->str(a->value_offset, a->value_length));
+}
+
+template <class O>
+inline if_output_t<O> operator<<(O &o, const snapshot_element_t &e) {
+  if (e.index() == 0) {
+    o << e.text();
+  } else {
+    o << "<\033[34m" << e.tag() << "\033[0m";
+    e.for_each_attr([&](std::string_view k, std::string_view v) {
+      o << " \033[31m" << k << "\033[0m=\033[32m" << v << "\033[0m";
+    });
+    o << ">";
+  }
+  return o;
+}
+
+/**
+ * @brief serializes flat_document_t into the snapshot format
+ */
+inline std::string snapshot_bytes(const flat_document_t &doc,
+                                  const snapshot_key_t &key = {}) {
+  std::vector<snapshot_node_t> nodes;
+  std::vector<snapshot_attr_t> attrs;
+  std::string strings;
+  nodes.reserve(doc.nodes.size());
+  attrs.reserve(doc.attrs.size());
+  // names repeat a lot, keep one copy of each
+  std::unordered_map<std::string_view, std::uint64_t> names;
+  auto store = [&](std::string_view s) -> std::uint64_t {
+    if (s.size() > ~std::uint32_t(0))
+      throw std::length_error("snapshot: string longer than 4GiB");
+    std::uint64_t offset = strings.size();
+    strings.append(s);
+    return offset;
+  };
+  auto store_name = [&](std::string_view s) {
+    auto found = names.find(s);
+    if (found != names.end())
+      return found->second;
+    std::uint64_t offset = store(s);
+    names.emplace(s, offset);
+    return offset;
+  };
+  for (auto &n : doc.nodes)
+    nodes.push_back({n.is_tag ? store_name(n.value) : store(n.value),
+                     std::uint32_t(n.value.size()), n.first_child,
+                     n.next_sibling, n.attr_begin, n.attr_count,
+                     n.is_tag ? 1u : 0u});
+  for (auto &a : doc.attrs) {
+    std::uint64_t name = store_name(a.name);
+    attrs.push_back({name, store(a.value), std::uint32_t(a.name.size()),
+                     std::uint32_t(a.value.size())});
+  }
+
+  snapshot_header_t h = {};
+  std::memcpy(h.magic, helpers::snapshot_magic, sizeof(h.magic));
+  h.version = snapshot_header_t::current_version;
+  h.byte_order = snapshot_header_t::byte_order_mark;
+  h.source_size = key.source_size;
+  h.source_mtime = key.source_mtime;
+  h.with_entities = key.with_entities ? 1 : 0;
+  h.node_count = nodes.size();
+  h.attr_count = attrs.size();
+  h.strings_size = strings.size();
+  h.nodes_offset = helpers::align_8(sizeof(h));
+  h.attrs_offset =
+      helpers::align_8(h.nodes_offset + nodes.size() * sizeof(snapshot_node_t));
+  h.strings_offset =
+      helpers::align_8(h.attrs_offset + attrs.size() * sizeof(snapshot_attr_t));
+  h.checksum = helpers::snapshot_header_checksum(h);
+
+  std::string ret(h.strings_offset + strings.size(), '\0');
+  std::memcpy(ret.data(), &h, sizeof(h));
+  std::memcpy(ret.data() + h.nodes_offset, nodes.data(),
+              nodes.size() * sizeof(snapshot_node_t));
+  std::memcpy(ret.data() + h.attrs_offset, attrs.data(),
+              attrs.size() * sizeof(snapshot_attr_t));
+  std::memcpy(ret.data() + h.strings_offset, strings.data(), strings.size());
+  return ret;
+}
+
+/**
+ * @brief writes the snapshot to a temporary file renamed to path, so readers
+ * never see a half written snapshot
+ */
+inline void write_snapshot(const std::string &path, const flat_document_t &doc,
+                           const snapshot_key_t &key = {}) {
+  const std::string bytes = snapshot_bytes(doc, key);
+  // unique per process, thread and call: concurrent writers of the same
+  // snapshot must not share a temporary file
+  static std::atomic<std::uint64_t> counter(0);
+  const std::string tmp =
+      path + ".tmp" + std::to_string(::getpid()) + "." +
+      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) +
+      "." + std::to_string(counter.fetch_add(1));
+  int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    throw std::system_error(errno, std::generic_category(), tmp);
+  try {
+    output_sink_t out(fd);
+    out.write(bytes);
+    out.flush();
+  } catch (...) {
+    ::close(fd);
+    ::unlink(tmp.c_str());
+    throw;
+  }
+  ::close(fd);
+  if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+    int e = errno;
+    ::unlink(tmp.c_str());
+    throw std::system_error(e, std::generic_category(), path);
+  }
+}
+
+/**
+ * @brief parse cache: the snapshot next to the source if it is up to date,
+ * otherwise parses the source and writes a new snapshot
+ *
+ * if the snapshot cannot be written (read only directory, for example) the
+ * result is kept in memory
+ */
+inline snapshot_t load_or_parse(const std::string &source_path,
+                                bool with_entities = true) {
+  const std::string snapshot_path = source_path + ".tpxs";
+  const snapshot_key_t key = snapshot_key_t::of_file(source_path, with_entities);
+  try {
+    snapshot_t cached(snapshot_path);
+    snapshot_key_t k = cached.key();
+    if ((k.source_size == key.source_size) &&
+        (k.source_mtime == key.source_mtime) &&
+        (k.with_entities == key.with_entities))
+      return cached;
+  } catch (const std::exception &) {
+    // missing or broken, make a new one
+  }
+  mapped_file_t source(source_path);
+  flat_document_t doc = helpers::build_flat_document(source.view(), with_entities);
+  try {
+    write_snapshot(snapshot_path, doc, key);
+    return snapshot_t(snapshot_path);
+  } catch (const std::system_error &) {
+    return snapshot_t::from_bytes(snapshot_bytes(doc, key));
+  }
+}
+
+/**
+ * walk_tree, walk_tree_io and walk_tags for snapshot_t. Callbacks receive
+ * snapshot_element_t.
+ * */
+template <class F>
+inline void walk_tree(const snapshot_t &doc, F f, int d = 0) {
+  helpers::walk_flat<snapshot_element_t>(doc, 0, f, d);
+}
+template <class F> inline void walk_tree(snapshot_t &doc, F f, int d = 0) {
+  helpers::walk_flat<snapshot_element_t>(doc, 0, f, d);
+}
+template <class F_PRE, class F_POST>
+inline void walk_tree_io(const snapshot_t &doc, F_PRE f_pre, F_POST f_post,
+                         int d = 0) {
+  helpers::walk_flat_io<snapshot_element_t>(doc, 0, f_pre, f_post, d);
+}
+template <class F_PRE, class F_POST>
+inline void walk_tree_io(snapshot_t &doc, F_PRE f_pre, F_POST f_post,
+                         int d = 0) {
+  helpers::walk_flat_io<snapshot_element_t>(doc, 0, f_pre, f_post, d);
+}
+
+template <class F>
+inline void walk_tags(const snapshot_t &doc, name_t name, F f) {
+  const std::string_view tag = name.str();
+  walk_tree(doc, [&](const snapshot_element_t &e, int d) {
+    if ((e.index() == 1) && (e.tag() == tag))
+      return walk_callback(f, e, d);
+    return WALK_CONTINUE;
+  });
+}
+template <class F> inline void walk_tags(snapshot_t &doc, name_t name, F f) {
+  walk_tags(static_cast<const snapshot_t &>(doc), name, f);
+}
+
+} // namespace xml
+} // namespace tp
+
+#endif
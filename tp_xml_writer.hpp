@@ -0,0 +1,208 @@
+
+/*
+FUNCTIONS:
+
+enum write_mode_e { WRITE_COMPACT, WRITE_PRETTY };
+
+template <class N> // tree_elem_t<element_t> or pmr::tree_t
+inline void write_xml(output_sink_t &out, const N &tree,
+    write_mode_e mode = WRITE_COMPACT);
+template <class N>
+inline std::string to_xml_string(const N &tree,
+    write_mode_e mode = WRITE_COMPACT);
+
+The inverse of text_to_xml_with_entities: parsing the output gives the same
+tree (in compact mode), except that text nodes that were split by comments
+or CDATA sections come back as one. Text escapes & < >, attribute values are written in
+double quotes and escape & < " and the backslash (the parser reads
+backslash escapes in values). Tags without children are written as <a/>.
+
+WRITE_PRETTY puts every child on its own indented line, except in elements
+that hold non white space text, and drops white space only text there.
+
+*/
+
+#ifndef __TP_XML_WRITER_HPP__
+#define __TP_XML_WRITER_HPP__
+
+#include <tp_output_sink.hpp>
+#include <tp_tree_xml.hpp>
+
+namespace tp {
+namespace xml {
+
+enum write_mode_e { WRITE_COMPACT,
+                    WRITE_PRETTY };
+
+namespace helpers {
+
+inline std::string_view escape_sequence(char c) {
+  switch (c) {
+  case '&':
+    return "&amp;";
+  case '<':
+    return "&lt;";
+  case '>':
+    return "&gt;";
+  case '"':
+    return "&quot;";
+  default:
+    return "&#92;"; // backslash
+  }
+}
+
+/**
+ * @brief writes s with the characters a, b, c and d replaced by entities.
+ * Runs between them are found with simd::find_any_of and copied in one
+ * piece.
+ */
+inline void write_escaped(output_sink_t &out, std::string_view s, char a,
+                          char b, char c, char d) {
+  const char *p = s.data();
+  const char *const e = p + s.size();
+  while (p < e) {
+    const char *q = simd::find_any_of(p, e, a, b, c, d);
+    out.write({p, std::size_t(q - p)});
+    if (q == e)
+      break;
+    out.write(escape_sequence(*q));
+    p = q + 1;
+  }
+}
+
+inline void write_text(output_sink_t &out, std::string_view s) {
+  write_escaped(out, s, '&', '<', '>', '>');
+}
+
+template <class L>
+inline void write_open_tag(output_sink_t &out, const basic_tag_t<L> &tag,
+                           bool self_closing) {
+  if (tag.is_markup()) {
+    out.write(tag.markup()); // <!...> or <?...?> kept as parsed
+    return;
+  }
+  const std::string_view name = tag.tag.str();
+  out.put('<');
+  out.write(name);
+  for (auto &[k, v] : tag.attr) {
+    out.put(' ');
+    out.write(k.str());
+    out.write("=\"");
+    write_escaped(out, v, '&', '<', '"', '\\');
+    out.put('"');
+  }
+  out.write(self_closing ? "/>" : ">");
+}
+
+template <class E> inline bool is_white_space_text(const E &e) {
+  if (e.index() != 0)
+    return false;
+  for (char c : std::get<0>(e))
+    if (!is_white_space(c))
+      return false;
+  return true;
+}
+
+/**
+ * true if children of n can be laid out on separate lines: there is no
+ * text in them apart from white space
+ */
+template <class N> inline bool element_only(const N &n) {
+  for (auto &c : n.children)
+    if ((c.value.index() == 0) && !is_white_space_text(c.value))
+      return false;
+  return true;
+}
+
+} // namespace helpers
+
+/**
+ * @brief writes the tree as xml. Iterative, any depth is fine. N is
+ * tree_elem_t<element_t> or pmr::tree_t.
+ */
+template <class N>
+inline void write_xml(output_sink_t &out, const N &tree,
+                      write_mode_e mode = WRITE_COMPACT) {
+  using node_t = N;
+  struct frame_t {
+    const node_t *node;
+    typename decltype(node_t::children)::const_iterator child;
+    bool pretty; // children on separate lines
+  };
+  bool first_line = true;
+  auto new_line = [&](std::size_t depth) {
+    if (!first_line)
+      out.put('\n');
+    first_line = false;
+    for (std::size_t i = 0; i < depth; i++)
+      out.write("  ");
+  };
+  // writes the node itself, returns true if its children follow (text
+  // nodes have children only as the document root)
+  auto open = [&](const node_t &n) {
+    const bool has_children = !n.children.empty();
+    if (n.value.index() == 0)
+      helpers::write_text(out, std::get<0>(n.value));
+    else
+      helpers::write_open_tag(out, std::get<1>(n.value), !has_children);
+    return has_children;
+  };
+
+  std::vector<frame_t> stack;
+  stack.reserve(32);
+  if (!open(tree)) {
+    if ((mode == WRITE_PRETTY) && (tree.value.index() == 1))
+      out.put('\n');
+    return;
+  }
+  stack.push_back({&tree, tree.children.begin(),
+                   (mode == WRITE_PRETTY) && helpers::element_only(tree)});
+  // the root is usually the empty text node that holds the document
+  const std::size_t root_depth = (tree.value.index() == 0) ? 0 : 1;
+  while (!stack.empty()) {
+    frame_t &f = stack.back();
+    const std::size_t depth = stack.size() - 1 + root_depth;
+    if (f.child == f.node->children.end()) {
+      const bool pretty = f.pretty;
+      const node_t *n = f.node;
+      stack.pop_back();
+      if (n->value.index() == 1) {
+        if (pretty)
+          new_line(depth - 1);
+        out.write("</");
+        out.write(std::get<1>(n->value).tag.str());
+        out.put('>');
+      }
+      continue;
+    }
+    const node_t &c = *f.child++;
+    if (f.pretty) {
+      if (helpers::is_white_space_text(c.value))
+        continue;
+      new_line(depth);
+    } else {
+      first_line = false;
+    }
+    if (open(c))
+      stack.push_back({&c, c.children.begin(),
+                       (mode == WRITE_PRETTY) && helpers::element_only(c)});
+  }
+  if ((mode == WRITE_PRETTY) && !first_line)
+    out.put('\n');
+}
+
+template <class N>
+inline std::string to_xml_string(const N &tree,
+                                 write_mode_e mode = WRITE_COMPACT) {
+  std::string ret;
+  {
+    output_sink_t out(ret, 64 * 1024);
+    write_xml(out, tree, mode);
+  }
+  return ret;
+}
+
+} // namespace xml
+} // namespace tp
+
+#endif